@@ -0,0 +1,20 @@
+/*
+ * Minimal stand-in for the pico-sdk <pico.h> used by the host build.
+ */
+#ifndef _4C0F8E21_6A3D_4B57_9D1E_2F7B0C5A93D4
+#define _4C0F8E21_6A3D_4B57_9D1E_2F7B0C5A93D4
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef __not_in_flash_func
+#define __not_in_flash_func(func_name) func_name
+#endif
+
+#ifndef __not_in_flash
+#define __not_in_flash(group)
+#endif
+
+typedef unsigned int uint;
+
+#endif /* _4C0F8E21_6A3D_4B57_9D1E_2F7B0C5A93D4 */
@@ -0,0 +1,40 @@
+/*
+ * Host stand-in for pico_lib's util/work_meter.h.
+ * Instead of drawing a meter, the time between two marks is accumulated
+ * into the bucket of the tag closing the span.
+ */
+#ifndef _7E2B5D90_13C4_4F0A_8B6E_C1D4A7F30E58
+#define _7E2B5D90_13C4_4F0A_8B6E_C1D4A7F30E58
+
+#include <stdint.h>
+
+namespace util
+{
+    extern bool workMeterEnabled_;
+
+    void WorkMeterMarkImpl(uint32_t tag);
+    void WorkMeterResetImpl();
+
+    inline void WorkMeterMark(uint32_t tag)
+    {
+        if (workMeterEnabled_)
+        {
+            WorkMeterMarkImpl(tag);
+        }
+    }
+
+    inline void WorkMeterReset()
+    {
+        if (workMeterEnabled_)
+        {
+            WorkMeterResetImpl();
+        }
+    }
+
+    // host only
+    void WorkMeterEnable(bool enable);
+    uint64_t WorkMeterGetTotalNS(uint32_t tag);
+    uint64_t WorkMeterGetUntaggedNS();
+}
+
+#endif /* _7E2B5D90_13C4_4F0A_8B6E_C1D4A7F30E58 */
@@ -0,0 +1,690 @@
+/*
+ * Headless InfoNES runner.
+ * Runs a ROM for a fixed number of frames as fast as possible and reports
+ * the emulation speed, so that core changes can be profiled on a desktop.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#if INFONES_RENDER_PIPE || INFONES_APU_PIPE
+#include <atomic>
+#include <thread>
+#endif
+
+#include <InfoNES.h>
+#include <InfoNES_System.h>
+#include <InfoNES_pAPU.h>
+#include <InfoNES_Movie.h>
+#include <InfoNES_Pipe.h>
+#include <K6502.h>
+#include <util/work_meter.h>
+#include "rom_selector.h"
+
+#define CC(x) (((x >> 1) & 15) | (((x >> 6) & 15) << 4) | (((x >> 11) & 15) << 8))
+const WORD NesPalette[64] = {
+    CC(0x39ce), CC(0x1071), CC(0x0015), CC(0x2013), CC(0x440e), CC(0x5402), CC(0x5000), CC(0x3c20),
+    CC(0x20a0), CC(0x0100), CC(0x0140), CC(0x00e2), CC(0x0ceb), CC(0x0000), CC(0x0000), CC(0x0000),
+    CC(0x5ef7), CC(0x01dd), CC(0x10fd), CC(0x401e), CC(0x5c17), CC(0x700b), CC(0x6ca0), CC(0x6521),
+    CC(0x45c0), CC(0x0240), CC(0x02a0), CC(0x0247), CC(0x0211), CC(0x0000), CC(0x0000), CC(0x0000),
+    CC(0x7fff), CC(0x1eff), CC(0x2e5f), CC(0x223f), CC(0x79ff), CC(0x7dd6), CC(0x7dcc), CC(0x7e67),
+    CC(0x7ae7), CC(0x4342), CC(0x2769), CC(0x2ff3), CC(0x03bb), CC(0x0000), CC(0x0000), CC(0x0000),
+    CC(0x7fff), CC(0x579f), CC(0x635f), CC(0x6b3f), CC(0x7f1f), CC(0x7f1b), CC(0x7ef6), CC(0x7f75),
+    CC(0x7f94), CC(0x73f4), CC(0x57d7), CC(0x5bf9), CC(0x4ffe), CC(0x0000), CC(0x0000), CC(0x0000)};
+
+namespace
+{
+    struct Options
+    {
+        int frames = 0;
+        int romIndex = 0;
+        int hashInterval = 60;
+        int frameSkip = 0;
+        unsigned seed = 0;
+        bool phases = false;
+        bool checksumAllFrames = false;
+        bool renderThread = false;
+        bool apuThread = false;
+        const char *dumpPath{};
+        const char *romPath{};
+        const char *recordPath{};
+        const char *playPath{};
+    };
+
+    Options options_;
+
+    std::vector<uint8_t> romFile_;
+    ROMSelector romSelector_;
+
+    WORD frameBuffer_[NES_DISP_HEIGHT][NES_DISP_WIDTH];
+
+    std::vector<uint8_t> movie_;
+    uint32_t random_ = 0;
+
+    int menuCount_ = 0;
+    int frameCount_ = 0;
+    uint64_t cpuClocks_ = 0;
+    uint64_t instructions_ = 0;
+    uint64_t idleClocks_ = 0;
+    uint64_t chrDecodes_ = 0;
+    WORD prevClocks_ = 0;
+    uint64_t startTime_ = 0;
+    uint64_t endTime_ = 0;
+
+    uint64_t videoHash_ = 0;
+    uint64_t audioHash_ = 0;
+
+#if INFONES_RENDER_PIPE || INFONES_APU_PIPE
+    // core1 の代わりに描画と音声合成をするスレッド
+    std::thread core1Thread_;
+    std::atomic<bool> core1Stop_{false};
+
+    // 描き終わって、まだ変換していないライン数
+    std::atomic<int> validLines_{0};
+
+    // core1 と同じく、変換するラインが届くまでリングから描いて、合成して待つ
+    // (出力先は常に空いている)
+    bool waitForLine()
+    {
+        while (!validLines_.load(std::memory_order_acquire))
+        {
+            if (core1Stop_)
+            {
+                return false;
+            }
+
+            bool busy = false;
+#if INFONES_RENDER_PIPE
+            busy |= InfoNES_PipeRender(1) != 0;
+#endif
+#if INFONES_APU_PIPE
+            busy |= InfoNES_pAPURender(1) != 0;
+#endif
+            if (!busy)
+            {
+                InfoNES_PipeWait();
+            }
+        }
+        return true;
+    }
+#endif
+
+    constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+    constexpr uint64_t FNV_PRIME = 0x100000001b3ull;
+
+    uint64_t fnv1a(uint64_t h, const void *data, size_t size)
+    {
+        auto p = static_cast<const uint8_t *>(data);
+        while (size--)
+        {
+            h = (h ^ *p++) * FNV_PRIME;
+        }
+        return h;
+    }
+
+    uint64_t now()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+    }
+
+    bool loadFile(const char *path, std::vector<uint8_t> &dst)
+    {
+        auto fp = fopen(path, "rb");
+        if (!fp)
+        {
+            return false;
+        }
+        fseek(fp, 0, SEEK_END);
+        auto size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        // tar の終端ブロック分の余白を付けておく
+        dst.assign(size + 1024, 0);
+        bool ok = fread(dst.data(), 1, size, fp) == static_cast<size_t>(size);
+        fclose(fp);
+        return ok;
+    }
+
+    bool parseROM(const uint8_t *nesFile)
+    {
+        memcpy(&NesHeader, nesFile, sizeof(NesHeader));
+        if (!checkNESMagic(NesHeader.byID))
+        {
+            return false;
+        }
+
+        nesFile += sizeof(NesHeader);
+
+        memset(SRAM, 0, SRAM_SIZE);
+
+        if (NesHeader.byInfo1 & 4)
+        {
+            memcpy(&SRAM[0x1000], nesFile, 512);
+            nesFile += 512;
+        }
+
+        auto romSize = NesHeader.byRomSize * 0x4000;
+        ROM = (BYTE *)nesFile;
+        nesFile += romSize;
+
+        if (NesHeader.byVRomSize > 0)
+        {
+            VROM = (BYTE *)nesFile;
+        }
+
+        return true;
+    }
+
+    void usage(const char *prog)
+    {
+        printf("usage: %s [options] <rom.nes | roms.tar>\n"
+               "  -n <frames>  number of frames to run (default 600)\n"
+               "  -i <index>   ROM index in a tar file (default 0)\n"
+               "  -p           measure time per phase (CPU, APU, BG, sprite)\n"
+               "  -c           checksum every frame instead of the last one\n"
+               "  -o <file>    write the last frame as a PPM image\n"
+               "  -s <seed>    press random buttons generated from the seed\n"
+               "  -r <file>    record the input to a movie file\n"
+               "  -m <file>    play a movie file (frames default to its length)\n"
+               "  -k <frames>  state hash interval when recording (default 60)\n"
+               "  -f <frames>  skip the frames after each drawn one (frame skip)\n"
+#if INFONES_RENDER_PIPE
+               "  -t           draw the scanlines on a thread (render pipeline)\n"
+#endif
+#if INFONES_APU_PIPE
+               "  -a           synthesize the sound on a thread (APU pipeline)\n"
+#endif
+               ,
+               prog);
+    }
+
+    bool parseOptions(int argc, char *argv[])
+    {
+        int opt;
+        while ((opt = getopt(argc, argv, "n:i:pco:s:r:m:k:f:tah")) != -1)
+        {
+            switch (opt)
+            {
+            case 'n':
+                options_.frames = atoi(optarg);
+                break;
+
+            case 'i':
+                options_.romIndex = atoi(optarg);
+                break;
+
+            case 'p':
+                options_.phases = true;
+                break;
+
+            case 'c':
+                options_.checksumAllFrames = true;
+                break;
+
+            case 'o':
+                options_.dumpPath = optarg;
+                break;
+
+            case 's':
+                options_.seed = strtoul(optarg, nullptr, 0);
+                break;
+
+            case 'r':
+                options_.recordPath = optarg;
+                break;
+
+            case 'm':
+                options_.playPath = optarg;
+                break;
+
+            case 'k':
+                options_.hashInterval = atoi(optarg);
+                break;
+
+            case 'f':
+                options_.frameSkip = atoi(optarg);
+                break;
+
+#if INFONES_RENDER_PIPE
+            case 't':
+                options_.renderThread = true;
+                break;
+#endif
+
+#if INFONES_APU_PIPE
+            case 'a':
+                options_.apuThread = true;
+                break;
+#endif
+
+            default:
+                return false;
+            }
+        }
+        if (optind != argc - 1 || options_.frames < 0 ||
+            options_.hashInterval < 0 || options_.hashInterval > 0xffff ||
+            options_.frameSkip < 0 ||
+            (options_.recordPath && options_.playPath) ||
+            (options_.renderThread && options_.phases)) // work meter はスレッド非対応
+        {
+            return false;
+        }
+        options_.romPath = argv[optind];
+        return true;
+    }
+
+    bool saveFile(const char *path, const uint8_t *data, size_t size)
+    {
+        auto fp = fopen(path, "wb");
+        if (!fp)
+        {
+            return false;
+        }
+        bool ok = fwrite(data, 1, size, fp) == size;
+        return fclose(fp) == 0 && ok;
+    }
+
+    DWORD randomPad()
+    {
+        // xorshift32. 数フレームごとにボタンを変える
+        if (frameCount_ % 4 == 0)
+        {
+            random_ ^= random_ << 13;
+            random_ ^= random_ >> 17;
+            random_ ^= random_ << 5;
+        }
+        return random_ & 0xff;
+    }
+
+    bool dumpFrame(const char *path)
+    {
+        auto fp = fopen(path, "wb");
+        if (!fp)
+        {
+            return false;
+        }
+        fprintf(fp, "P6\n%d %d\n255\n", NES_DISP_WIDTH, NES_DISP_HEIGHT);
+        for (auto &line : frameBuffer_)
+        {
+            for (auto c : line)
+            {
+                // RGB444 (NesPalette の形式)
+                uint8_t rgb[] = {
+                    static_cast<uint8_t>(((c >> 8) & 15) * 17),
+                    static_cast<uint8_t>(((c >> 4) & 15) * 17),
+                    static_cast<uint8_t>((c & 15) * 17),
+                };
+                fwrite(rgb, 1, sizeof(rgb), fp);
+            }
+        }
+        fclose(fp);
+        return true;
+    }
+
+    void report()
+    {
+        double sec = (endTime_ - startTime_) * 1e-9;
+        double fps = frameCount_ / sec;
+
+        printf("mapper         : %d\n", MapperNo);
+        printf("frames         : %d\n", frameCount_);
+        printf("elapsed        : %.3f s\n", sec);
+        printf("frames/sec     : %.1f (x%.2f realtime)\n", fps, fps / 60.0);
+        printf("CPU cycles/sec : %.2f M\n", cpuClocks_ / sec * 1e-6);
+        printf("instr/sec      : %.2f M (%s dispatch)\n", instructions_ / sec * 1e-6,
+#if K6502_THREADED_DISPATCH
+               "threaded"
+#else
+               "switch"
+#endif
+        );
+        printf("idle cycles    : %.0f /frame (%.1f%%)\n",
+               frameCount_ ? double(idleClocks_) / frameCount_ : 0.0,
+               cpuClocks_ ? idleClocks_ * 100.0 / cpuClocks_ : 0.0);
+        printf("chr cache      : %.1f KB, %.2f pages decoded /frame\n",
+               sizeof(WORD) * 64 * 8 * CHR_CACHE_PAGES / 1024.0,
+               frameCount_ ? double(chrDecodes_) / frameCount_ : 0.0);
+#if INFONES_RENDER_PIPE
+        printf("render         : %s", RenderPipe ? "pipeline thread" : "in place");
+        if (PipeStopCnt)
+            printf(" (pipeline stopped %u times by writes outside PPU RAM)", unsigned(PipeStopCnt));
+        printf("\n");
+#endif
+#if INFONES_APU_PIPE
+        printf("sound          : %s\n", ApuPipe ? "pipeline thread" : "in place");
+#endif
+
+        if (options_.phases)
+        {
+            struct Phase
+            {
+                const char *name;
+                uint64_t ns;
+            } phases[] = {
+                {"cpu", util::WorkMeterGetTotalNS(MARKER_CPU)},
+                {"apu", util::WorkMeterGetTotalNS(MARKER_SOUND)},
+                {"bg", util::WorkMeterGetTotalNS(MARKER_BG)},
+                {"sprite", util::WorkMeterGetTotalNS(MARKER_SPRITE)},
+                {"other", util::WorkMeterGetTotalNS(MARKER_START) +
+                              util::WorkMeterGetUntaggedNS()},
+            };
+            uint64_t total = 0;
+            for (auto &p : phases)
+            {
+                total += p.ns;
+            }
+            for (auto &p : phases)
+            {
+                printf("  %-12s : %8.2f ms %5.1f%%  %7.2f us/frame\n",
+                       p.name, p.ns * 1e-6,
+                       total ? p.ns * 100.0 / total : 0.0,
+                       p.ns * 1e-3 / frameCount_);
+            }
+            if (phases[0].ns)
+            {
+                printf("  instr/cpu sec : %.2f M\n", instructions_ / (phases[0].ns * 1e-9) * 1e-6);
+            }
+        }
+
+        if (!options_.checksumAllFrames)
+        {
+            videoHash_ = fnv1a(FNV_OFFSET, frameBuffer_, sizeof(frameBuffer_));
+        }
+        printf("video checksum : %016llx\n", (unsigned long long)videoHash_);
+        printf("audio checksum : %016llx\n", (unsigned long long)audioHash_);
+        printf("state hash     : %016llx\n", (unsigned long long)InfoNES_StateHash());
+
+        if (options_.playPath)
+        {
+            if (MovieDesyncFrame < 0)
+            {
+                printf("movie          : %d/%d frames, in sync\n", MovieFrame, MovieLength);
+            }
+            else
+            {
+                printf("movie          : %d/%d frames, desync at frame %d\n",
+                       MovieFrame, MovieLength, MovieDesyncFrame);
+            }
+        }
+    }
+}
+
+/*-------------------------------------------------------------------*/
+/*  InfoNES_System                                                   */
+/*-------------------------------------------------------------------*/
+
+int InfoNES_Menu()
+{
+    if (menuCount_++)
+    {
+        return -1;
+    }
+
+    auto rom = romSelector_.getCurrentROM();
+    if (!rom || !parseROM(rom))
+    {
+        printf("NES file parse error.\n");
+        return -1;
+    }
+    if (InfoNES_Reset() < 0)
+    {
+        printf("NES reset error.\n");
+        return -1;
+    }
+    FrameSkip = options_.frameSkip;
+
+    if (options_.recordPath)
+    {
+        // ヘッダ + 1フレームあたり最大 (入力 + ハッシュ)
+        movie_.assign(MOVIE_HEADER_SIZE +
+                          options_.frames * (MOVIE_RECORD_SIZE + MOVIE_HASH_SIZE),
+                      0);
+        InfoNES_MovieRecord(movie_.data(), movie_.size(), options_.hashInterval);
+    }
+    else if (options_.playPath &&
+             InfoNES_MoviePlay(movie_.data(), movie_.size()) < 0)
+    {
+        return -1;
+    }
+
+    videoHash_ = audioHash_ = FNV_OFFSET;
+    prevClocks_ = getPassedClocks();
+    g_dwInstructions = 0;
+    g_dwIdleClocks = 0;
+    ChrCacheDecodes = 0;
+    util::WorkMeterEnable(options_.phases);
+    startTime_ = now();
+    return 0;
+}
+
+int InfoNES_ReadRom(const char *pszFileName)
+{
+    if (!loadFile(pszFileName, romFile_))
+    {
+        return -1;
+    }
+    romSelector_.init(reinterpret_cast<uintptr_t>(romFile_.data()));
+    return romSelector_.getCurrentROM() ? 0 : -1;
+}
+
+void InfoNES_ReleaseRom()
+{
+    ROM = nullptr;
+    VROM = nullptr;
+}
+
+void InfoNES_LoadFrame()
+{
+#if INFONES_RENDER_PIPE
+    InfoNES_PipeSync();
+#endif
+    if (options_.checksumAllFrames)
+    {
+        videoHash_ = fnv1a(videoHash_, frameBuffer_, sizeof(frameBuffer_));
+    }
+}
+
+void InfoNES_PadState(DWORD *pdwPad1, DWORD *pdwPad2, DWORD *pdwSystem)
+{
+    WORD clocks = getPassedClocks();
+    cpuClocks_ += static_cast<WORD>(clocks - prevClocks_);
+    prevClocks_ = clocks;
+    instructions_ += g_dwInstructions;
+    g_dwInstructions = 0;
+    idleClocks_ += g_dwIdleClocks;
+    g_dwIdleClocks = 0;
+#if INFONES_RENDER_PIPE
+    // ChrCacheDecodes は描画スレッドが数える
+    InfoNES_PipeSync();
+#endif
+    chrDecodes_ += ChrCacheDecodes;
+    ChrCacheDecodes = 0;
+
+    *pdwPad1 = options_.seed ? randomPad() : 0;
+    *pdwPad2 = 0;
+    *pdwSystem = 0;
+
+    if (++frameCount_ >= options_.frames)
+    {
+        endTime_ = now();
+        *pdwSystem = PAD_SYS_QUIT;
+    }
+}
+
+void InfoNES_DebugPrint(const char *pszMsg)
+{
+    printf("%s", pszMsg);
+}
+
+void InfoNES_SoundInit()
+{
+}
+
+int InfoNES_SoundOpen(int samples_per_sync, int sample_rate)
+{
+    return 0;
+}
+
+void InfoNES_SoundClose()
+{
+}
+
+int InfoNES_GetSoundBufferSize()
+{
+    return 1024;
+}
+
+void InfoNES_SoundOutput(int samples, const short *lr)
+{
+    // 実機に渡すサンプルをチェックサムに畳み込む
+    audioHash_ = fnv1a(audioHash_, lr, samples * 2 * sizeof(short));
+}
+
+void InfoNES_MessageBox(const char *pszMsg, ...)
+{
+    printf("[MSG]");
+    va_list args;
+    va_start(args, pszMsg);
+    vprintf(pszMsg, args);
+    va_end(args);
+    printf("\n");
+}
+
+void InfoNES_PreDrawLine(int line)
+{
+    InfoNES_SetLineBuffer(frameBuffer_[line], NES_DISP_WIDTH);
+}
+
+void InfoNES_PostDrawLine(int line)
+{
+#if INFONES_RENDER_PIPE || INFONES_APU_PIPE
+    validLines_.fetch_add(1, std::memory_order_release);
+#endif
+}
+
+#if INFONES_RENDER_PIPE || INFONES_APU_PIPE
+void InfoNES_PipeWait()
+{
+    std::this_thread::yield();
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    if (!parseOptions(argc, argv))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (InfoNES_ReadRom(options_.romPath) < 0)
+    {
+        printf("%s: cannot load.\n", options_.romPath);
+        return 1;
+    }
+    for (int i = 0; i < options_.romIndex; ++i)
+    {
+        romSelector_.next();
+    }
+
+    if (options_.playPath)
+    {
+        if (!loadFile(options_.playPath, movie_))
+        {
+            printf("%s: cannot load.\n", options_.playPath);
+            return 1;
+        }
+        // loadFile の余白を取り除く
+        movie_.resize(movie_.size() - 1024);
+        if (!options_.frames)
+        {
+            // ヘッダだけ先に見てフレーム数を得る
+            if (InfoNES_MoviePlay(movie_.data(), movie_.size()) < 0)
+            {
+                return 1;
+            }
+            options_.frames = MovieLength;
+            InfoNES_MovieStop();
+        }
+    }
+    if (!options_.frames)
+    {
+        options_.frames = 600;
+    }
+    random_ = options_.seed;
+
+#if INFONES_RENDER_PIPE
+    if (options_.renderThread)
+    {
+        InfoNES_PipeEnable(1);
+    }
+#endif
+#if INFONES_APU_PIPE
+    if (options_.apuThread)
+    {
+        InfoNES_pAPUPipeEnable(1);
+    }
+#endif
+#if INFONES_RENDER_PIPE || INFONES_APU_PIPE
+    if (options_.renderThread || options_.apuThread)
+    {
+        core1Thread_ = std::thread([] {
+            // core1_main と同じ順に、1 ライン変換しては 1 ライン描いて合成する
+            while (waitForLine())
+            {
+                validLines_.fetch_sub(1, std::memory_order_relaxed);
+#if INFONES_RENDER_PIPE
+                InfoNES_PipeRender(1);
+#endif
+#if INFONES_APU_PIPE
+                InfoNES_pAPURender(1);
+#endif
+            }
+        });
+    }
+#endif
+
+    InfoNES_Main();
+
+#if INFONES_RENDER_PIPE || INFONES_APU_PIPE
+    if (core1Thread_.joinable())
+    {
+#if INFONES_RENDER_PIPE
+        InfoNES_PipeSync();
+#endif
+#if INFONES_APU_PIPE
+        InfoNES_pAPUSync();
+#endif
+        core1Stop_ = true;
+        core1Thread_.join();
+    }
+#endif
+
+    if (!frameCount_)
+    {
+        return 1;
+    }
+    report();
+
+    if (options_.recordPath)
+    {
+        auto size = InfoNES_MovieStop();
+        if (!saveFile(options_.recordPath, movie_.data(), size))
+        {
+            printf("%s: cannot write.\n", options_.recordPath);
+            return 1;
+        }
+    }
+
+    if (options_.dumpPath && !dumpFrame(options_.dumpPath))
+    {
+        printf("%s: cannot write.\n", options_.dumpPath);
+        return 1;
+    }
+    return MovieDesyncFrame < 0 ? 0 : 2;
+}
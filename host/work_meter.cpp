@@ -0,0 +1,91 @@
+/*
+ * Host implementation of the work meter used by the InfoNES core.
+ */
+
+#include <util/work_meter.h>
+#include <time.h>
+
+namespace util
+{
+    bool workMeterEnabled_ = false;
+
+    namespace
+    {
+        constexpr int MAX_TAGS = 16;
+
+        struct Bucket
+        {
+            uint32_t tag;
+            uint64_t ns;
+        };
+
+        Bucket buckets_[MAX_TAGS];
+        int nBuckets_ = 0;
+        uint64_t untaggedNS_ = 0;
+        uint64_t lastMark_ = 0;
+
+        uint64_t now()
+        {
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+        }
+
+        uint64_t &getBucket(uint32_t tag)
+        {
+            for (int i = 0; i < nBuckets_; ++i)
+            {
+                if (buckets_[i].tag == tag)
+                {
+                    return buckets_[i].ns;
+                }
+            }
+            if (nBuckets_ == MAX_TAGS)
+            {
+                return untaggedNS_;
+            }
+            auto &b = buckets_[nBuckets_++];
+            b = {tag, 0};
+            return b.ns;
+        }
+    }
+
+    void WorkMeterMarkImpl(uint32_t tag)
+    {
+        auto t = now();
+        getBucket(tag) += t - lastMark_;
+        lastMark_ = t;
+    }
+
+    void WorkMeterResetImpl()
+    {
+        auto t = now();
+        untaggedNS_ += t - lastMark_;
+        lastMark_ = t;
+    }
+
+    void WorkMeterEnable(bool enable)
+    {
+        workMeterEnabled_ = enable;
+        nBuckets_ = 0;
+        untaggedNS_ = 0;
+        lastMark_ = now();
+    }
+
+    uint64_t WorkMeterGetTotalNS(uint32_t tag)
+    {
+        for (int i = 0; i < nBuckets_; ++i)
+        {
+            if (buckets_[i].tag == tag)
+            {
+                return buckets_[i].ns;
+            }
+        }
+        return 0;
+    }
+
+    uint64_t WorkMeterGetUntaggedNS()
+    {
+        return untaggedNS_;
+    }
+}
@@ -39,6 +39,8 @@
 #include "InfoNES_System.h"
 #include "InfoNES_Mapper.h"
 #include "InfoNES_pAPU.h"
+#include "InfoNES_Movie.h"
+#include "InfoNES_Pipe.h"
 #include "K6502.h"
 #include <assert.h>
 #include <pico.h>
@@ -46,19 +48,6 @@
 
 #include <util/work_meter.h>
 
-constexpr uint16_t makeTag(int r, int g, int b)
-{
-  return (r << 10) | (g << 5) | (b);
-}
-enum
-{
-  MARKER_START = makeTag(0, 31, 31),
-  MARKER_CPU = makeTag(0, 31, 0),
-  MARKER_SOUND = makeTag(31, 31, 0),
-  MARKER_BG = makeTag(0, 0, 31),
-  MARKER_SPRITE = makeTag(31, 0, 0),
-};
-
 /*-------------------------------------------------------------------*/
 /*  NES resources                                                    */
 /*-------------------------------------------------------------------*/
@@ -99,6 +88,18 @@ BYTE *PPUBANK[16];
 /* Sprite RAM */
 BYTE SPRRAM[SPRRAM_SIZE];
 
+/* Update flag for the sprite line lists */
+BYTE SprLineUpdate;
+
+/* Sprites on each scanline ( offsets into SPRRAM, lowest first ) */
+static BYTE SprLineList[NES_DISP_HEIGHT][SPR_LINE_MAX];
+
+/* The number of sprites on each scanline ( may exceed SPR_LINE_MAX ) */
+static BYTE SprLineCnt[NES_DISP_HEIGHT];
+
+/* Sprite height the lists were made for */
+static WORD SprLineHeight;
+
 /* PPU Register */
 BYTE PPU_R0;
 BYTE PPU_R1;
@@ -140,11 +141,11 @@ BYTE PPU_ScanTable[263];
 /* Name Table Bank */
 BYTE PPU_NameTableBank;
 
-/* BG Base Address */
-BYTE *PPU_BG_Base;
+/* BG Base Address ( in the pattern tables ) */
+WORD PPU_BG_Base;
 
-/* Sprite Base Address */
-BYTE *PPU_SP_Base;
+/* Sprite Base Address ( in the pattern tables ) */
+WORD PPU_SP_Base;
 
 /* Sprite Height */
 WORD PPU_SP_Height;
@@ -163,7 +164,26 @@ BYTE PPU_UpDown_Clip;
 
 /* Frame IRQ ( 0: Disabled, 1: Enabled )*/
 BYTE FrameIRQ_Enable;
-WORD FrameStep;
+
+/* Writes to the PPU are logged ( the current scanline is drawn ) */
+BYTE PPULogOn;
+
+/* The mapper lets a scanline be drawn more than once */
+static BYTE PPULogEnable;
+
+/* Writes in the middle of the current scanline */
+static struct InfoNES_PPULog_tag PPULog[PPU_LOG_MAX];
+static int PPULogCnt;
+
+/*-------------------------------------------------------------------*/
+/*  Event resources                                                  */
+/*-------------------------------------------------------------------*/
+
+/* The clock of each event */
+static DWORD EventClock[EVENT_COUNT];
+
+/* The events set ( 1 << EVENT_* ) */
+static BYTE EventMask;
 
 /*-------------------------------------------------------------------*/
 /*  Display and Others resouces                                      */
@@ -188,15 +208,55 @@ void __not_in_flash_func(InfoNES_SetLineBuffer)(WORD *p, WORD size)
 }
 #endif
 
-/* Character Buffer */
-BYTE ChrBuf[256 * 2 * 8 * 8];
+/* Decoded pattern cache ( see InfoNES_SyncChr() ) */
+struct ChrCache_tag
+{
+  const BYTE *pbySrc;         // 1KB page the rows came from ( NULL: empty )
+  WORD wRows[64 * 8];         // 2 bits per dot, the left end in bit 15-14
+};
+static struct ChrCache_tag ChrCache[CHR_CACHE_PAGES];
+
+// The eviction needs a page that none of the other 7 banks holds
+static_assert(CHR_CACHE_PAGES >= 8, "CHR_CACHE_PAGES must be 8 or more");
+static int nChrCacheNext;
+
+/* Cache entry of each pattern bank ( PPUBANK[0] - PPUBANK[7] ) */
+static BYTE ChrCacheIdx[8];
+
+/* Decoded rows of each pattern bank */
+static const WORD *ChrRows[8];
+
+/* Rendering the BG ( a bank switch by MapperPPU takes effect at once ) */
+static BYTE byChrInLine;
+
+/* The number of decoded pages */
+DWORD ChrCacheDecodes;
 
-/* Update flag for ChrBuf */
-BYTE ChrBufUpdate;
+/* Palettes of the BG tiles ( see InfoNES_SyncAttr() ) */
+struct AttrCache_tag
+{
+  const BYTE *pbySrc;         // 1KB name table the palettes came from ( NULL: empty )
+  BYTE byAttr[32 * 32];       // 0 - 3 for each tile ( rows 30 and 31 too )
+};
+static struct AttrCache_tag AttrCache[ATTR_CACHE_PAGES];
+// The eviction skips the page the other name table of the scanline holds
+static_assert(ATTR_CACHE_PAGES >= 2, "ATTR_CACHE_PAGES must be 2 or more");
+static int nAttrCacheNext;
 
 /* Palette Table */
 WORD PalTable[32];
 
+/* Update flags for PalPairBG ( a bit per BG palette ) */
+BYTE PalPairUpdate;
+
+/* Colors of two BG dots ( the left one in the lower half ) */
+static uint32_t PalPairBG[4][16];
+
+/* A segment of a split scanline and the state it is drawn from */
+static WORD SplitLine[NES_DISP_WIDTH];
+static WORD SplitPalTable[32];
+static BYTE *SplitBank[16];
+
 /* Table for Mirroring */
 BYTE PPU_MirrorTable[][4] =
     {
@@ -243,11 +303,16 @@ BYTE(*MapperReadApu)
 void (*MapperVSync)();
 /* Callback at HSync */
 void (*MapperHSync)();
+/* Callback at EVENT_MAPPER */
+void (*MapperEvent)();
 /* Callback at PPU read/write */
 void (*MapperPPU)(WORD wAddr); // mapper 96だけ？
 /* Callback at Rendering Screen 1:BG, 0:Sprite */
 void (*MapperRenderScreen)(BYTE byMode);
 
+/* Callbacks which aren't the Map0 no-ops ( MAPPER_HOOK_* ) */
+BYTE MapperHooks;
+
 /*-------------------------------------------------------------------*/
 /*  ROM information                                                  */
 /*-------------------------------------------------------------------*/
@@ -380,6 +445,11 @@ int InfoNES_Reset()
 
   int nIdx;
 
+#if INFONES_RENDER_PIPE
+  // Let core 1 finish before the resources are reset
+  InfoNES_PipeStop();
+#endif
+
   /*-------------------------------------------------------------------*/
   /*  Get information on the cassette                                  */
   /*-------------------------------------------------------------------*/
@@ -420,8 +490,8 @@ int InfoNES_Reset()
   WorkFrameIdx = 0;
 #endif
 
-  // Reset update flag of ChrBuf
-  ChrBufUpdate = 0xff;
+  // Empty the decoded pattern cache and the palette pair tables
+  InfoNES_ResetRender();
 
   // Reset palette table
   InfoNES_MemorySet(PalTable, 0, sizeof PalTable);
@@ -433,6 +503,10 @@ int InfoNES_Reset()
   PAD1_Latch = PAD2_Latch = PAD_System = 0;
   PAD1_Bit = PAD2_Bit = 0;
 
+  // Reset events ( mappers with an IRQ counter set MapperEvent )
+  EventMask = 0;
+  MapperEvent = NULL;
+
   /*-------------------------------------------------------------------*/
   /*  Initialize PPU                                                   */
   /*-------------------------------------------------------------------*/
@@ -466,12 +540,37 @@ int InfoNES_Reset()
   // Set up a mapper initialization function
   MapperTable[nIdx].pMapperInit();
 
+  // The callbacks are set only by the initialization,
+  // so the per scanline and per tile calls can skip the no-ops
+  MapperHooks = 0;
+  if (MapperVSync != Map0_VSync)
+    MapperHooks |= MAPPER_HOOK_VSYNC;
+  if (MapperHSync != Map0_HSync)
+    MapperHooks |= MAPPER_HOOK_HSYNC;
+  if (MapperPPU != Map0_PPU)
+    MapperHooks |= MAPPER_HOOK_PPU;
+  if (MapperRenderScreen != Map0_RenderScreen)
+    MapperHooks |= MAPPER_HOOK_RENDER_SCREEN;
+
+  // Mappers which watch the rendering can't have a scanline drawn twice
+  PPULogEnable = !(MapperHooks & (MAPPER_HOOK_PPU | MAPPER_HOOK_RENDER_SCREEN));
+  PPULogOn = 0;
+  PPULogCnt = 0;
+
   /*-------------------------------------------------------------------*/
   /*  Reset CPU                                                        */
   /*-------------------------------------------------------------------*/
 
   K6502_Reset();
 
+  // The end of the first scanline
+  InfoNES_SetEvent(EVENT_HSYNC, STEP_PER_SCANLINE);
+
+#if INFONES_RENDER_PIPE
+  // Pass the scanlines to core 1 if the mapper allows
+  InfoNES_PipeStart();
+#endif
+
   // Successful
   return 0;
 }
@@ -492,6 +591,7 @@ void InfoNES_SetupPPU()
   // Clear PPU and Sprite Memory
   InfoNES_MemorySet(PPURAM, 0, sizeof PPURAM);
   InfoNES_MemorySet(SPRRAM, 0, sizeof SPRRAM);
+  SprLineUpdate = 1;
 
   // Reset PPU Register
   PPU_R0 = PPU_R1 = PPU_R2 = PPU_R3 = PPU_R7 = 0;
@@ -502,7 +602,6 @@ void InfoNES_SetupPPU()
   // Reset up and down clipping flag
   PPU_UpDown_Clip = 0;
 
-  FrameStep = 0;
   FrameIRQ_Enable = 0;
 
   // Reset Scroll values
@@ -524,8 +623,8 @@ void InfoNES_SetupPPU()
   // Reset information on PPU_R0
   PPU_Increment = 1;
   PPU_NameTableBank = NAME_TABLE0;
-  PPU_BG_Base = ChrBuf;
-  PPU_SP_Base = ChrBuf + 256 * 64;
+  PPU_BG_Base = 0x0000;
+  PPU_SP_Base = 0x1000;
   PPU_SP_Height = 8;
 
   // Reset PPU banks
@@ -600,6 +699,58 @@ void InfoNES_Main()
   InfoNES_Fin();
 }
 
+/*===================================================================*/
+/*                                                                   */
+/*           InfoNES_SetEvent() : Set an event at a CPU clock        */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_SetEvent)(int nEvent, DWORD dwClock)
+{
+  /*
+ *  Set an event at a CPU clock
+ *
+ *  Parameters
+ *    int nEvent                (Read)
+ *      Event ( EVENT_* )
+ *
+ *    DWORD dwClock             (Read)
+ *      CPU clock ( K6502_GetClocks )
+ *
+ *  Remarks
+ *    An event set in the middle of K6502_Run() ( by an I/O write ) ends
+ *    the run there if it's earlier.
+ */
+
+  EventClock[nEvent] = dwClock;
+  EventMask |= 1 << nEvent;
+  K6502_SetDeadline(dwClock);
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*              InfoNES_ClearEvent() : Cancel an event               */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_ClearEvent)(int nEvent)
+{
+  EventMask &= ~(1 << nEvent);
+}
+
+// The nearest event ( EVENT_HSYNC is always set )
+static int __not_in_flash_func(InfoNES_NextEvent)()
+{
+  int nNext = EVENT_HSYNC;
+  for (int nEvent = EVENT_HSYNC - 1; nEvent >= 0; --nEvent)
+  {
+    if ((EventMask & (1 << nEvent)) &&
+        (int)(EventClock[nEvent] - EventClock[nNext]) <= 0)
+    {
+      nNext = nEvent;
+    }
+  }
+  return nNext;
+}
+
 /*===================================================================*/
 /*                                                                   */
 /*              InfoNES_Cycle() : The loop of emulation              */
@@ -610,8 +761,14 @@ void __not_in_flash_func(InfoNES_Cycle)()
   /*
  *  The loop of emulation
  *
+ *  Remarks
+ *    The CPU runs straight to the nearest event. The events set the
+ *    next ones, e.g. each EVENT_HSYNC sets the end of the next scanline.
  */
 
+  int nEvent;
+  DWORD dwClock;
+
   // Set the PPU adress to the buffered value
   // if ((PPU_R1 & R1_SHOW_SP) || (PPU_R1 & R1_SHOW_SCR))
   //   PPU_Addr = PPU_Temp;
@@ -621,16 +778,19 @@ void __not_in_flash_func(InfoNES_Cycle)()
   {
     util::WorkMeterMark(MARKER_START);
 
-    // Set a flag if a scanning line is a hit in the sprite #0
-    if (SpriteJustHit == PPU_Scanline &&
-        PPU_ScanTable[PPU_Scanline] == SCAN_ON_SCREEN)
-    {
-      // # of Steps to execute before sprite #0 hit
-      int nStep = SPRRAM[SPR_X] * STEP_PER_SCANLINE / NES_DISP_WIDTH;
+    // Execute instructions
+    K6502_Run(EventClock[InfoNES_NextEvent()]);
+
+    util::WorkMeterMark(MARKER_CPU);
 
-      // Execute instructions
-      K6502_Step(nStep);
+    // An I/O write may have set an earlier event meanwhile
+    nEvent = InfoNES_NextEvent();
+    dwClock = EventClock[nEvent];
+    InfoNES_ClearEvent(nEvent);
 
+    switch (nEvent)
+    {
+    case EVENT_SPRITE_HIT:
       // Set a sprite hit flag
       if ((PPU_R1 & R1_SHOW_SP) && (PPU_R1 & R1_SHOW_SCR))
         PPU_R2 |= R2_HIT_SP;
@@ -638,36 +798,45 @@ void __not_in_flash_func(InfoNES_Cycle)()
       // NMI is required if there is necessity
       if ((PPU_R0 & R0_NMI_SP) && (PPU_R1 & R1_SHOW_SP))
         NMI_REQ;
+      break;
 
-      // Execute instructions
-      K6502_Step(STEP_PER_SCANLINE - nStep);
-    }
-    else
-    {
-      // Execute instructions
-      K6502_Step(STEP_PER_SCANLINE);
-    }
-
-    // Frame IRQ in H-Sync
-    FrameStep += STEP_PER_SCANLINE;
-    if (FrameStep > STEP_PER_FRAME && FrameIRQ_Enable)
-    {
-      FrameStep %= STEP_PER_FRAME;
+    case EVENT_FRAME_IRQ:
+      // Frame IRQ ( once per frame until $4017 disables it )
       IRQ_REQ;
-      APU_Reg[0x4015] |= 0x40;
-    }
+      APU_Reg[0x15] |= 0x40;
+      InfoNES_SetEvent(EVENT_FRAME_IRQ, dwClock + STEP_PER_FRAME);
+      break;
 
-    util::WorkMeterMark(MARKER_CPU);
+    case EVENT_MAPPER:
+      // A mapper function at the CPU clock
+      MapperEvent();
+      break;
+
+    case EVENT_HSYNC:
+      InfoNES_SetEvent(EVENT_HSYNC, dwClock + STEP_PER_SCANLINE);
 
-    // A mapper function in H-Sync
-    MapperHSync();
+      // A mapper function in H-Sync
+      if (MapperHooks & MAPPER_HOOK_HSYNC)
+        MapperHSync();
 
-    // A function in H-Sync
-    if (InfoNES_HSync() == -1)
-      return; // To the menu screen
+      // A function in H-Sync
+      if (InfoNES_HSync() == -1)
+        return; // To the menu screen
 
-    // HSYNC Wait
-    InfoNES_Wait();
+      // HSYNC Wait
+      InfoNES_Wait();
+
+      // Set an event if the next scanline is a hit in the sprite #0
+      if (SpriteJustHit == PPU_Scanline &&
+          PPU_ScanTable[PPU_Scanline] == SCAN_ON_SCREEN)
+      {
+        // # of Steps to execute before sprite #0 hit ( EVENT_HSYNC is on dot 256 )
+        int nStep = (SPRRAM[SPR_X] + DOT_PER_SCANLINE - NES_DISP_WIDTH) *
+                    STEP_PER_SCANLINE / DOT_PER_SCANLINE;
+        InfoNES_SetEvent(EVENT_SPRITE_HIT, dwClock + nStep);
+      }
+      break;
+    }
   }
 }
 
@@ -699,17 +868,35 @@ int __not_in_flash_func(InfoNES_HSync)()
   /*-------------------------------------------------------------------*/
   /*  Render a scanline                                                */
   /*-------------------------------------------------------------------*/
-  if (FrameCnt == 0 &&
-      PPU_ScanTable[PPU_Scanline] == SCAN_ON_SCREEN)
+  if (PPU_ScanTable[PPU_Scanline] == SCAN_ON_SCREEN)
   {
-    if (PPU_Scanline >= 4 && PPU_Scanline < 240 - 4)
+    if (FrameCnt == 0 &&
+        PPU_Scanline >= 4 && PPU_Scanline < 240 - 4)
     {
       InfoNES_PreDrawLine(PPU_Scanline);
-      InfoNES_DrawLine();
-      InfoNES_PostDrawLine(PPU_Scanline);
+#if INFONES_RENDER_PIPE
+      if (RenderPipe)
+      {
+        // Core 1 draws it and calls InfoNES_PostDrawLine()
+        InfoNES_SkipLine();
+        InfoNES_PipeLine(SprLineList[PPU_Scanline],
+                         (PPU_R1 & R1_SHOW_SP) ? SprLineCnt[PPU_Scanline] : 0,
+                         PPULog, PPULogCnt);
+      }
+      else
+#endif
+      {
+        InfoNES_DrawLine();
+        InfoNES_PostDrawLine(PPU_Scanline);
+      }
+    }
+    else
+    {
+      // Cropped or skipped lines still change the PPU and mapper state
+      InfoNES_SkipLine();
     }
-    // todo: 描画しないラインにもスプライトオーバーレジスタとかは反映する必要がある
   }
+  PPULogCnt = 0;
 
   util::WorkMeterReset(); // 計測起点はここ
 
@@ -793,6 +980,11 @@ int __not_in_flash_func(InfoNES_HSync)()
     // FrameCnt + 1
     FrameCnt = (FrameCnt >= FrameSkip) ? 0 : FrameCnt + 1;
 
+#if INFONES_RENDER_PIPE
+    // Pass the scanlines to core 1 again after a write outside PPU RAM
+    InfoNES_PipeVBlank();
+#endif
+
     // Set a V-Blank flag
     PPU_R2 |= R2_IN_VBLANK;
     // printf("vb : pc %04x, r2 %02x\n", PC, PPU_R2);
@@ -805,11 +997,15 @@ int __not_in_flash_func(InfoNES_HSync)()
     InfoNES_pAPUVsync();
 
     // A mapper function in V-Sync
-    MapperVSync();
+    if (MapperHooks & MAPPER_HOOK_VSYNC)
+      MapperVSync();
 
     // Get the condition of the joypad
     InfoNES_PadState(&PAD1_Latch, &PAD2_Latch, &PAD_System);
 
+    // Record or replay the joypad state
+    InfoNES_MovieSync(&PAD1_Latch, &PAD2_Latch, &PAD_System);
+
     // NMI on V-Blank
     if (PPU_R0 & R0_NMI_VB)
     {
@@ -824,6 +1020,11 @@ int __not_in_flash_func(InfoNES_HSync)()
     break;
   }
 
+  // Log the writes in the middle of the next scanline if it's drawn
+  PPULogOn = PPULogEnable && FrameCnt == 0 &&
+             PPU_ScanTable[PPU_Scanline] == SCAN_ON_SCREEN &&
+             PPU_Scanline >= 4 && PPU_Scanline < 240 - 4;
+
   // Successful
   return 0;
 }
@@ -832,13 +1033,17 @@ int __not_in_flash_func(InfoNES_HSync)()
 
 namespace
 {
+  // groups : a bit per 8 dots that a sprite was put on ( bit 0 : x = 0 - 7 )
   void __not_in_flash_func(compositeSprite)(const uint16_t *pal,
                                             const uint8_t *spr,
-                                            uint16_t *buf)
+                                            uint16_t *buf,
+                                            uint32_t groups)
   {
-    auto sprEnd = spr + NES_DISP_WIDTH;
-    do
+    for (; groups; groups >>= 1, buf += 8, spr += 8)
     {
+      if (!(groups & 1))
+        continue;
+
       auto proc = [=](int i) __attribute__((always_inline))
       {
         int v = spr[i];
@@ -848,333 +1053,575 @@ namespace
         }
       };
 
-#if 1
       proc(0);
       proc(1);
       proc(2);
       proc(3);
-      buf += 4;
-      spr += 4;
-#else
-      proc(0);
-      buf += 1;
-      spr += 1;
-#endif
-    } while (spr < sprEnd);
+      proc(4);
+      proc(5);
+      proc(6);
+      proc(7);
+    }
+  }
+
+  // BG tiles nX - ( nEnd - 1 ) of a name table row
+  //  bOddDot   : the tiles start on an odd dot ( fine scroll is odd )
+  //  bMapperPPU: call MapperPPU() for each tile ( MAPPER_HOOK_PPU )
+  template <bool bOddDot, bool bMapperPPU>
+  __attribute__((always_inline)) inline WORD *
+  putBGTiles(WORD *pPoint, const BYTE *pbyNameTable, const BYTE *pbyAttr,
+             int nX, int nEnd, const WORD *pwPalTable,
+             WORD wBGBase, int bankOfsBG, int yOfsModBG)
+  {
+    for (; nX < nEnd; ++nX, ++pbyNameTable, pPoint += 8)
+    {
+      const int attr = pbyAttr[nX];
+      const auto pairAddr = reinterpret_cast<uintptr_t>(PalPairBG[attr]);
+      const int ch = *pbyNameTable;
+      const int bank = (ch >> 6) + bankOfsBG;
+      const int row = ChrRows[bank][((ch & 63) << 3) + yOfsModBG];
+
+      // Two dots are a byte offset into the pair table ( 4 bytes per pair )
+      auto readPair = [&](int ofs) {
+        return *reinterpret_cast<const uint32_t *>(pairAddr + ofs);
+      };
+      const auto dst = reinterpret_cast<uint32_t *>(pPoint);
+      if (!bOddDot)
+      {
+        dst[0] = readPair((row >> 10) & 0x3c);
+        dst[1] = readPair((row >> 6) & 0x3c);
+        dst[2] = readPair((row >> 2) & 0x3c);
+        dst[3] = readPair((row << 2) & 0x3c);
+      }
+      else
+      {
+        // Dots 0 and 7 are single, 1 - 6 are written in pairs
+        const auto pal = &pwPalTable[attr << 2];
+        pPoint[0] = pal[row >> 14];
+        *reinterpret_cast<uint32_t *>(pPoint + 1) = readPair((row >> 8) & 0x3c);
+        *reinterpret_cast<uint32_t *>(pPoint + 3) = readPair((row >> 4) & 0x3c);
+        *reinterpret_cast<uint32_t *>(pPoint + 5) = readPair(row & 0x3c);
+        pPoint[7] = pal[row & 3];
+      }
+
+      // Callback at PPU read/write ( may switch ChrRows for the next tile )
+      if (bMapperPPU)
+        MapperPPU(wBGBase + (ch << 4) + yOfsModBG);
+    }
+    return pPoint;
+  }
+
+  // The instantiations are wrapped in plain functions,
+  // GCC ignores the section attribute of a template
+#define PUT_BG_TILES(name, odd, mapper)                                              \
+  WORD *__not_in_flash_func(name)(WORD *pPoint, const BYTE *pbyNameTable,            \
+                                  const BYTE *pbyAttr, int nX, int nEnd,             \
+                                  const WORD *pwPalTable, WORD wBGBase,              \
+                                  int bankOfsBG, int yOfsModBG)                      \
+  {                                                                                  \
+    return putBGTiles<odd, mapper>(pPoint, pbyNameTable, pbyAttr, nX, nEnd,          \
+                                   pwPalTable, wBGBase, bankOfsBG, yOfsModBG);     \
   }
+
+  PUT_BG_TILES(putBGTilesEven, false, false)
+  PUT_BG_TILES(putBGTilesOdd, true, false)
+  PUT_BG_TILES(putBGTilesEvenPPU, false, true)
+  PUT_BG_TILES(putBGTilesOddPPU, true, true)
+#undef PUT_BG_TILES
+
+  // [ bMapperPPU ][ bOddDot ]
+  WORD *(*const putBGTilesTable[2][2])(WORD *, const BYTE *, const BYTE *, int, int,
+                                       const WORD *, WORD, int, int) = {
+      {putBGTilesEven, putBGTilesOdd},
+      {putBGTilesEvenPPU, putBGTilesOddPPU},
+  };
 }
 
 /*===================================================================*/
 /*                                                                   */
-/*              InfoNES_DrawLine() : Render a scanline               */
+/*        InfoNES_SetupSprLines() : Make the sprite line lists       */
 /*                                                                   */
 /*===================================================================*/
-void __not_in_flash_func(InfoNES_DrawLine)()
+static void __not_in_flash_func(InfoNES_SetupSprLines)()
 {
   /*
- *  Render a scanline
+ *  Sort the sprites into lists of the scanlines they are on
+ *
+ *  Remarks
+ *    Made again only when Sprite RAM or the sprite height is changed,
+ *    instead of testing all 64 sprites on every scanline.
+ *    Like the PPU, only the first SPR_LINE_MAX sprites of a scanline
+ *    are kept.
+ */
+  int nSpr;
+  int nLine;
+  int nEnd;
+
+  InfoNES_MemorySet(SprLineCnt, 0, sizeof SprLineCnt);
+
+  for (nSpr = 0; nSpr < SPRRAM_SIZE; nSpr += 4)
+  {
+    nLine = SPRRAM[nSpr + SPR_Y] + 1;
+    nEnd = nLine + PPU_SP_Height;
+    if (nEnd > NES_DISP_HEIGHT)
+      nEnd = NES_DISP_HEIGHT;
+
+    for (; nLine < nEnd; ++nLine)
+    {
+      int nCnt = SprLineCnt[nLine]++;
+      if (nCnt < SPR_LINE_MAX)
+        SprLineList[nLine][nCnt] = nSpr;
+    }
+  }
+
+  SprLineHeight = PPU_SP_Height;
+  SprLineUpdate = 0;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*   InfoNES_EvalSprLine() : Count the sprites on the scanline       */
+/*                                                                   */
+/*===================================================================*/
+static int __not_in_flash_func(InfoNES_EvalSprLine)()
+{
+  /*
+ *  Count the sprites on the scanline and set R2_MAX_SP
  *
+ *  Return values
+ *    The number of sprites on the scanline ( 0 : sprites are off )
  */
+  int nSprCnt = 0;
+
+  if (PPU_R1 & R1_SHOW_SP)
+  {
+    // Reset Scanline Sprite Count
+    PPU_R2 &= ~R2_MAX_SP;
+
+    if (SprLineUpdate || SprLineHeight != PPU_SP_Height)
+      InfoNES_SetupSprLines();
+    nSprCnt = SprLineCnt[PPU_Scanline];
+    if (nSprCnt >= 8)
+      PPU_R2 |= R2_MAX_SP; // Set a flag of maximum sprites on scanline
+  }
+  return nSprCnt;
+}
 
+/*===================================================================*/
+/*                                                                   */
+/*      InfoNES_SkipLine() : Go through a scanline without drawing   */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_SkipLine)()
+{
+  /*
+ *  Go through a scanline without drawing
+ *
+ *  Remarks
+ *    Does what InfoNES_DrawLine() does to the emulation state :
+ *    MapperRenderScreen(), MapperPPU() for each BG tile and R2_MAX_SP.
+ *    Sprite #0 hit doesn't depend on drawing ( InfoNES_GetSprHitY() ).
+ */
   int nX;
   int nY;
-  int nY4;
   int nYBit;
-  WORD *pPalTbl;
-  BYTE *pAttrBase;
-  WORD *pPoint;
   int nNameTable;
   BYTE *pbyNameTable;
-  BYTE *pbyChrData;
-  BYTE *pSPRRAM;
-  int nAttr;
-  int nSprCnt;
-  int nIdx;
-  int nSprData;
-  BYTE bySprCol;
-  BYTE pSprBuf[NES_DISP_WIDTH + 7];
-
-  /*-------------------------------------------------------------------*/
-  /*  Render Background                                                */
-  /*-------------------------------------------------------------------*/
 
   /* MMC5 VROM switch */
-  MapperRenderScreen(1);
-
-  // Pointer to the render position
-  //  pPoint = &WorkFrame[PPU_Scanline * NES_DISP_WIDTH];
-  assert(WorkLine);
-  pPoint = WorkLine;
+  if (MapperHooks & MAPPER_HOOK_RENDER_SCREEN)
+    MapperRenderScreen(1);
 
-  // Clear a scanline if screen is off
-  if (!(PPU_R1 & R1_SHOW_SCR))
-  {
-    InfoNES_MemorySet(pPoint, 0, NES_DISP_WIDTH << 1);
-  }
-  else
+  // Only MMC2 and MMC4 watch the pattern fetches
+  if ((PPU_R1 & R1_SHOW_SCR) && (MapperHooks & MAPPER_HOOK_PPU))
   {
     nNameTable = PPU_NameTableBank;
+    nY = (PPU_Addr >> 5) & 31;
+    nYBit = PPU_Addr >> 12;
 
-#if 0
-    nY = PPU_Scr_V_Byte + (PPU_Scanline >> 3);
-    nYBit = PPU_Scr_V_Bit + (PPU_Scanline & 7);
-
-    if (nYBit > 7)
+    // The left table from the block of the left end
+    pbyNameTable = PPUBANK[nNameTable] + nY * 32 + PPU_Scr_H_Byte;
+    for (nX = PPU_Scr_H_Byte; nX < 32; ++nX)
     {
-      ++nY;
-      nYBit &= 7;
+      MapperPPU(PPU_BG_Base + (*pbyNameTable << 4) + nYBit);
+      ++pbyNameTable;
     }
-    const int yOfsModBG = nYBit;
-    nYBit <<= 3;
 
-    if (nY > 29)
+    // The right table to the block of the right end
+    pbyNameTable = PPUBANK[nNameTable ^ NAME_TABLE_H_MASK] + nY * 32;
+    for (nX = 0; nX <= PPU_Scr_H_Byte; ++nX)
     {
-      // Next NameTable (An up-down direction)
-      nNameTable ^= NAME_TABLE_V_MASK;
-      nY -= 30;
+      MapperPPU(PPU_BG_Base + (*pbyNameTable << 4) + nYBit);
+      ++pbyNameTable;
     }
-#else
-    nY = (PPU_Addr >> 5) & 31;
-    const int yOfsModBG = PPU_Addr >> 12;
-    nYBit = yOfsModBG << 3;
-#endif
-
-    nX = PPU_Scr_H_Byte;
+  }
 
-    nY4 = ((nY & 2) << 1);
+  /* MMC5 VROM switch */
+  if (MapperHooks & MAPPER_HOOK_RENDER_SCREEN)
+    MapperRenderScreen(0);
 
-    //
-    const int patternTableIdBG = PPU_R0 & R0_BG_ADDR ? 1 : 0;
-    const int bankOfsBG = patternTableIdBG << 2;
+  InfoNES_EvalSprLine();
+}
 
-    /*-------------------------------------------------------------------*/
-    /*  Rendering of the block of the left end                           */
-    /*-------------------------------------------------------------------*/
+/*===================================================================*/
+/*                                                                   */
+/*      InfoNES_SetupPalPair() : Make the BG palette pair tables     */
+/*                                                                   */
+/*===================================================================*/
+static void __not_in_flash_func(InfoNES_SetupPalPair)(const WORD *pwPalTable)
+{
+  /*
+ *  Make the pair tables of the BG palettes marked in PalPairUpdate
+ *
+ *  Parameters
+ *    const WORD *pwPalTable           (Read)
+ *      PalTable or the copy of the render pipeline
+ *
+ *  Remarks
+ *    An entry is indexed by two dots ( the left one in bit 3-2 ), so
+ *    that the BG is written 32 bits at a time.
+ */
+  int nPal;
+  int nIdx;
 
-    pbyNameTable = PPUBANK[nNameTable] + nY * 32 + nX;
-    pbyChrData = PPU_BG_Base + (*pbyNameTable << 6) + nYBit;
-    pAttrBase = PPUBANK[nNameTable] + 0x3c0 + (nY / 4) * 8;
-#if 0
-    pPalTbl = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
+  for (nPal = 0; nPal < 4; ++nPal)
+  {
+    if (!((PalPairUpdate >> nPal) & 1))
+      continue; // Next palette
 
-    for (nIdx = PPU_Scr_H_Bit; nIdx < 8; ++nIdx)
-    {
-      *(pPoint++) = pPalTbl[pbyChrData[nIdx]];
-    }
-#else
+    const WORD *pPal = &pwPalTable[nPal << 2];
+    for (nIdx = 0; nIdx < 16; ++nIdx)
     {
-      pPoint += 8 - PPU_Scr_H_Bit;
-
-      const auto pal = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-      const int ch = *pbyNameTable;
-      const int bank = (ch >> 6) + bankOfsBG;
-      const int addrOfs = ((ch & 63) << 4) + yOfsModBG;
-      const auto data = PPUBANK[bank] + addrOfs;
-      const auto pl0 = data[0];
-      const auto pl1 = data[8];
-      const auto pat0 = (pl0 & 0x55) | ((pl1 << 1) & 0xaa);
-      const auto pat1 = ((pl0 >> 1) & 0x55) | (pl1 & 0xaa);
-      switch (PPU_Scr_H_Bit)
-      {
-      case 0:
-        pPoint[-8] = pal[(pat1 >> 6) & 3];
-      case 1:
-        pPoint[-7] = pal[(pat0 >> 6) & 3];
-      case 2:
-        pPoint[-6] = pal[(pat1 >> 4) & 3];
-      case 3:
-        pPoint[-5] = pal[(pat0 >> 4) & 3];
-      case 4:
-        pPoint[-4] = pal[(pat1 >> 2) & 3];
-      case 5:
-        pPoint[-3] = pal[(pat0 >> 2) & 3];
-      case 6:
-        pPoint[-2] = pal[(pat1 >> 0) & 3];
-      case 7:
-        pPoint[-1] = pal[(pat0 >> 0) & 3];
-      default:
-        break;
-      }
+      // Little endian : the left dot is the lower half
+      PalPairBG[nPal][nIdx] = pPal[nIdx >> 2] | ((uint32_t)pPal[nIdx & 3] << 16);
     }
-#endif
+  }
+  PalPairUpdate = 0;
+}
 
-    // Callback at PPU read/write
-    MapperPPU(PATTBL(pbyChrData));
+/* The palette of each tile of a name table */
+static void InfoNES_DecodeAttr(struct AttrCache_tag *pCache, const BYTE *pbySrc)
+{
+  int nY;
+  int nX;
 
-    ++nX;
-    ++pbyNameTable;
+  for (nY = 0; nY < 32; ++nY)
+  {
+    const BYTE *pbyAttr = pbySrc + 0x3c0 + (nY >> 2) * 8;
+    for (nX = 0; nX < 32; ++nX)
+      pCache->byAttr[(nY << 5) + nX] = (pbyAttr[nX >> 2] >> ((nX & 2) + ((nY & 2) << 1))) & 3;
+  }
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*    InfoNES_SyncAttr() : Get the palettes of the BG tiles          */
+/*                                                                   */
+/*===================================================================*/
+static const BYTE *__not_in_flash_func(InfoNES_SyncAttr)(const BYTE *pbySrc, const BYTE *pbyKeep)
+{
+  /*
+ *  Get the palettes of the BG tiles of a name table
+ *
+ *  Parameters
+ *    const BYTE *pbySrc               (Read)
+ *      The 1KB name table
+ *
+ *    const BYTE *pbyKeep              (Read)
+ *      The other name table of the scanline, not to be evicted
+ *
+ *  Return values
+ *    Palettes ( 0 - 3 ) of the 32 x 32 tiles
+ *
+ *  Remarks
+ *    Entries are keyed by the address of the name table like the
+ *    decoded pattern cache, so a change of the mirroring costs nothing.
+ *    Writes to the attribute tables keep the entries valid
+ *    ( see InfoNES_AttrWrite() ).
+ */
+  int nIdx;
+
+  for (nIdx = 0; nIdx < ATTR_CACHE_PAGES; ++nIdx)
+  {
+    if (AttrCache[nIdx].pbySrc == pbySrc)
+      return AttrCache[nIdx].byAttr;
+  }
+
+  // Evict an entry but the other name table
+  do
+  {
+    nIdx = nAttrCacheNext;
+    nAttrCacheNext = (nAttrCacheNext + 1) % ATTR_CACHE_PAGES;
+  } while (AttrCache[nIdx].pbySrc == pbyKeep);
+
+  AttrCache[nIdx].pbySrc = pbySrc;
+  InfoNES_DecodeAttr(&AttrCache[nIdx], pbySrc);
+  return AttrCache[nIdx].byAttr;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*      InfoNES_RenderLine() : Render a scanline from a view         */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_RenderLine)(const struct InfoNES_LineView_tag *pView)
+{
+  /*
+ *  Render a scanline from a view
+ *
+ *  Parameters
+ *    const struct InfoNES_LineView_tag *pView  (Read)
+ *      The PPU state to draw from
+ *
+ *  Remarks
+ *    Nothing but the view, the decoded pattern cache and the palette
+ *    pair tables is read, so that the scanline can also be drawn from
+ *    the copies kept by the render pipeline ( see InfoNES_Pipe.cpp ).
+ */
+
+  int nX;
+  int nY;
+  int nYBit;
+  WORD *pPalTbl;
+  const BYTE *pbyAttr;
+  WORD *pPoint;
+  int nNameTable;
+  BYTE *pbyNameTable;
+  BYTE *pbyChrData;
+  BYTE *pSPRRAM;
+  int nAttr;
+  int nSprCnt;
+  int nIdx;
+  int nSprData;
+  BYTE bySprCol;
+  BYTE pSprBuf[NES_DISP_WIDTH + 7];
+
+  const int nScanline = pView->wScanline;
+  const WORD wAddr = pView->wAddr;
+  const BYTE byR0 = pView->byR0;
+  const BYTE byR1 = pView->byR1;
+  const BYTE byScrHByte = pView->byScrHByte;
+  const BYTE byScrHBit = pView->byScrHBit;
+  BYTE *const *ppbyBank = pView->ppbyBank;
+  WORD *const pwPalTable = pView->pwPalTable;
+  BYTE *const pbySprRam = pView->pbySprRam;
+  WORD *const pwLine = pView->pwLine;
+  const WORD wBGBase = (byR0 & R0_BG_ADDR) ? 0x1000 : 0x0000;
+  const int nSPHeight = (byR0 & R0_SP_SIZE) ? 16 : 8;
+
+  /*-------------------------------------------------------------------*/
+  /*  Render Background                                                */
+  /*-------------------------------------------------------------------*/
+
+  // The mapper callbacks are no-ops for most mappers
+  const bool bMapperPPU = MapperHooks & MAPPER_HOOK_PPU;
+  const bool bMapperScreen = MapperHooks & MAPPER_HOOK_RENDER_SCREEN;
+
+  /* MMC5 VROM switch */
+  if (bMapperScreen)
+    MapperRenderScreen(1);
+  InfoNES_SyncChr(ppbyBank);
+  byChrInLine = 1;
+
+  // Pointer to the render position
+  //  pPoint = &WorkFrame[nScanline * NES_DISP_WIDTH];
+  assert(pwLine);
+  pPoint = pwLine;
+
+  // Clear a scanline if screen is off
+  if (!(byR1 & R1_SHOW_SCR))
+  {
+    InfoNES_MemorySet(pPoint, 0, NES_DISP_WIDTH << 1);
+  }
+  else
+  {
+    nNameTable = NAME_TABLE0 + ((wAddr >> 10) & 3);
+
+#if 0
+    nY = PPU_Scr_V_Byte + (nScanline >> 3);
+    nYBit = PPU_Scr_V_Bit + (nScanline & 7);
+
+    if (nYBit > 7)
+    {
+      ++nY;
+      nYBit &= 7;
+    }
+    const int yOfsModBG = nYBit;
+    nYBit <<= 3;
+
+    if (nY > 29)
+    {
+      // Next NameTable (An up-down direction)
+      nNameTable ^= NAME_TABLE_V_MASK;
+      nY -= 30;
+    }
+#else
+    nY = (wAddr >> 5) & 31;
+    const int yOfsModBG = wAddr >> 12;
+    nYBit = yOfsModBG << 3;
+#endif
+
+    nX = byScrHByte;
+
+    //
+    const int patternTableIdBG = byR0 & R0_BG_ADDR ? 1 : 0;
+    const int bankOfsBG = patternTableIdBG << 2;
 
     /*-------------------------------------------------------------------*/
-    /*  Rendering of the left table                                      */
+    /*  Rendering of the block of the left end                           */
     /*-------------------------------------------------------------------*/
 
-    auto putBG = [&](int nX) __attribute__((always_inline))
+    pbyNameTable = ppbyBank[nNameTable] + nY * 32 + nX;
+    pbyAttr = InfoNES_SyncAttr(ppbyBank[nNameTable], ppbyBank[nNameTable ^ NAME_TABLE_H_MASK]) + (nY << 5);
+#if 0
+    pPalTbl = &pwPalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
+
+    for (nIdx = byScrHBit; nIdx < 8; ++nIdx)
     {
-      const auto pal = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-      const auto palAddr = reinterpret_cast<uintptr_t>(pal);
+      *(pPoint++) = pPalTbl[pbyChrData[nIdx]];
+    }
+#else
+    {
+      pPoint += 8 - byScrHBit;
+
+      const auto pal = &pwPalTable[pbyAttr[nX] << 2];
       const int ch = *pbyNameTable;
       const int bank = (ch >> 6) + bankOfsBG;
-      const int addrOfs = ((ch & 63) << 4) + yOfsModBG;
-      const auto data = PPUBANK[bank] + addrOfs;
-      const auto pl0 = data[0];
-      const auto pl1 = data[8];
-      // const auto pat0 = (pl0 & 0x55) | ((pl1 << 1) & 0xaa);
-      // const auto pat1 = ((pl0 >> 1) & 0x55) | (pl1 & 0xaa);
-      const auto pat0 = ((pl0 & 0x55) << 1) | ((pl1 & 0x55) << 2);
-      const auto pat1 = ((pl0 & 0xaa) << 0) | ((pl1 & 0xaa) << 1);
-
-      auto readPal = [&](int ofs) {
-        return *reinterpret_cast<const WORD *>(palAddr + ofs);
-      };
-      pPoint[0] = readPal((pat1 >> 6) & 6);
-      pPoint[1] = readPal((pat0 >> 6) & 6);
-      pPoint[2] = readPal((pat1 >> 4) & 6);
-      pPoint[3] = readPal((pat0 >> 4) & 6);
-      pPoint[4] = readPal((pat1 >> 2) & 6);
-      pPoint[5] = readPal((pat0 >> 2) & 6);
-      pPoint[6] = readPal((pat1 >> 0) & 6);
-      pPoint[7] = readPal((pat0 >> 0) & 6);
-      pPoint += 8;
-    };
-
-    for (; nX < 32; ++nX)
-    {
-#if 0
-      pbyChrData = PPU_BG_Base + (*pbyNameTable << 6) + nYBit;
-      pPalTbl = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-
-      pPoint[0] = pPalTbl[pbyChrData[0]];
-      pPoint[1] = pPalTbl[pbyChrData[1]];
-      pPoint[2] = pPalTbl[pbyChrData[2]];
-      pPoint[3] = pPalTbl[pbyChrData[3]];
-      pPoint[4] = pPalTbl[pbyChrData[4]];
-      pPoint[5] = pPalTbl[pbyChrData[5]];
-      pPoint[6] = pPalTbl[pbyChrData[6]];
-      pPoint[7] = pPalTbl[pbyChrData[7]];
-      pPoint += 8;
-#else
-      putBG(nX);
+      const int row = ChrRows[bank][((ch & 63) << 3) + yOfsModBG];
+      switch (byScrHBit)
+      {
+      case 0:
+        pPoint[-8] = pal[(row >> 14) & 3];
+      case 1:
+        pPoint[-7] = pal[(row >> 12) & 3];
+      case 2:
+        pPoint[-6] = pal[(row >> 10) & 3];
+      case 3:
+        pPoint[-5] = pal[(row >> 8) & 3];
+      case 4:
+        pPoint[-4] = pal[(row >> 6) & 3];
+      case 5:
+        pPoint[-3] = pal[(row >> 4) & 3];
+      case 6:
+        pPoint[-2] = pal[(row >> 2) & 3];
+      case 7:
+        pPoint[-1] = pal[(row >> 0) & 3];
+      default:
+        break;
+      }
+    }
 #endif
 
-      // Callback at PPU read/write
-      MapperPPU(PATTBL(pbyChrData));
+    // Callback at PPU read/write
+    if (bMapperPPU)
+      MapperPPU(wBGBase + (*pbyNameTable << 4) + yOfsModBG);
 
-      ++pbyNameTable;
-    }
+    ++nX;
+    ++pbyNameTable;
+
+    /*-------------------------------------------------------------------*/
+    /*  Rendering of the left table                                      */
+    /*-------------------------------------------------------------------*/
+
+    if (PalPairUpdate)
+      InfoNES_SetupPalPair(pwPalTable);
+
+    // The fine scroll decides whether a tile starts on a 32bit boundary
+    const bool bOddDot = reinterpret_cast<uintptr_t>(pPoint) & 2;
+    const auto putBGTiles = putBGTilesTable[bMapperPPU][bOddDot];
+
+    pPoint = putBGTiles(pPoint, pbyNameTable, pbyAttr, nX, 32,
+                        pwPalTable, wBGBase, bankOfsBG, yOfsModBG);
 
     // Holizontal Mirror
     nNameTable ^= NAME_TABLE_H_MASK;
 
-    pbyNameTable = PPUBANK[nNameTable] + nY * 32;
-    pAttrBase = PPUBANK[nNameTable] + 0x3c0 + (nY / 4) * 8;
+    pbyNameTable = ppbyBank[nNameTable] + nY * 32;
+    pbyAttr = InfoNES_SyncAttr(ppbyBank[nNameTable], ppbyBank[nNameTable ^ NAME_TABLE_H_MASK]) + (nY << 5);
 
     /*-------------------------------------------------------------------*/
     /*  Rendering of the right table                                     */
     /*-------------------------------------------------------------------*/
 
-    for (nX = 0; nX < PPU_Scr_H_Byte; ++nX)
-    {
-#if 0
-      pbyChrData = PPU_BG_Base + (*pbyNameTable << 6) + nYBit;
-      pPalTbl = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-
-      pPoint[0] = pPalTbl[pbyChrData[0]];
-      pPoint[1] = pPalTbl[pbyChrData[1]];
-      pPoint[2] = pPalTbl[pbyChrData[2]];
-      pPoint[3] = pPalTbl[pbyChrData[3]];
-      pPoint[4] = pPalTbl[pbyChrData[4]];
-      pPoint[5] = pPalTbl[pbyChrData[5]];
-      pPoint[6] = pPalTbl[pbyChrData[6]];
-      pPoint[7] = pPalTbl[pbyChrData[7]];
-      pPoint += 8;
-#else
-      putBG(nX);
-#endif
-
-      // Callback at PPU read/write
-      MapperPPU(PATTBL(pbyChrData));
-
-      ++pbyNameTable;
-    }
+    pPoint = putBGTiles(pPoint, pbyNameTable, pbyAttr, 0, byScrHByte,
+                        pwPalTable, wBGBase, bankOfsBG, yOfsModBG);
+    nX = byScrHByte;
+    pbyNameTable += byScrHByte;
 
     /*-------------------------------------------------------------------*/
     /*  Rendering of the block of the right end                          */
     /*-------------------------------------------------------------------*/
 
 #if 0
-    pbyChrData = PPU_BG_Base + (*pbyNameTable << 6) + nYBit;
-    pPalTbl = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
-    for (nIdx = 0; nIdx < PPU_Scr_H_Bit; ++nIdx)
+    pbyChrData = pbyBGBase + (*pbyNameTable << 6) + nYBit;
+    pPalTbl = &pwPalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
+    for (nIdx = 0; nIdx < byScrHBit; ++nIdx)
     {
       pPoint[nIdx] = pPalTbl[pbyChrData[nIdx]];
     }
 #else
     {
-      const auto pal = &PalTable[(((pAttrBase[nX >> 2] >> ((nX & 2) + nY4)) & 3) << 2)];
+      const auto pal = &pwPalTable[pbyAttr[nX] << 2];
       const int ch = *pbyNameTable;
       const int bank = (ch >> 6) + bankOfsBG;
-      const int addrOfs = ((ch & 63) << 4) + yOfsModBG;
-      const auto data = PPUBANK[bank] + addrOfs;
-      const auto pl0 = data[0];
-      const auto pl1 = data[8];
-      const auto pat0 = (pl0 & 0x55) | ((pl1 << 1) & 0xaa);
-      const auto pat1 = ((pl0 >> 1) & 0x55) | (pl1 & 0xaa);
-      //      const auto [pat0, pat1] = getPatBG(ch);
-      switch (PPU_Scr_H_Bit)
+      const int row = ChrRows[bank][((ch & 63) << 3) + yOfsModBG];
+      switch (byScrHBit)
       {
       case 8:
-        pPoint[7] = pal[(pat0 >> 0) & 3];
+        pPoint[7] = pal[(row >> 0) & 3];
       case 7:
-        pPoint[6] = pal[(pat1 >> 0) & 3];
+        pPoint[6] = pal[(row >> 2) & 3];
       case 6:
-        pPoint[5] = pal[(pat0 >> 2) & 3];
+        pPoint[5] = pal[(row >> 4) & 3];
       case 5:
-        pPoint[4] = pal[(pat1 >> 2) & 3];
+        pPoint[4] = pal[(row >> 6) & 3];
       case 4:
-        pPoint[3] = pal[(pat0 >> 4) & 3];
+        pPoint[3] = pal[(row >> 8) & 3];
       case 3:
-        pPoint[2] = pal[(pat1 >> 4) & 3];
+        pPoint[2] = pal[(row >> 10) & 3];
       case 2:
-        pPoint[1] = pal[(pat0 >> 6) & 3];
+        pPoint[1] = pal[(row >> 12) & 3];
       case 1:
-        pPoint[0] = pal[(pat1 >> 6) & 3];
+        pPoint[0] = pal[(row >> 14) & 3];
       default:
         break;
       }
 
-      //      pPoint += PPU_Scr_H_Bit;
+      //      pPoint += byScrHBit;
     }
 #endif
 
     // Callback at PPU read/write
-    MapperPPU(PATTBL(pbyChrData));
+    if (bMapperPPU)
+      MapperPPU(wBGBase + (*pbyNameTable << 4) + yOfsModBG);
 
     /*-------------------------------------------------------------------*/
     /*  Backgroud Clipping                                               */
     /*-------------------------------------------------------------------*/
-    if (!(PPU_R1 & R1_CLIP_BG))
+    if (!(byR1 & R1_CLIP_BG))
     {
       WORD *pPointTop;
 
-      // pPointTop = &WorkFrame[PPU_Scanline * NES_DISP_WIDTH];
-      pPointTop = WorkLine;
+      // pPointTop = &WorkFrame[nScanline * NES_DISP_WIDTH];
+      pPointTop = pwLine;
       InfoNES_MemorySet(pPointTop, 0, 8 << 1);
     }
 
     /*-------------------------------------------------------------------*/
     /*  Clear a scanline if up and down clipping flag is set             */
     /*-------------------------------------------------------------------*/
-    if (PPU_UpDown_Clip &&
-        (SCAN_ON_SCREEN_START > PPU_Scanline || PPU_Scanline > SCAN_BOTTOM_OFF_SCREEN_START))
+    if (pView->byUpDownClip &&
+        (SCAN_ON_SCREEN_START > nScanline || nScanline > SCAN_BOTTOM_OFF_SCREEN_START))
     {
       WORD *pPointTop;
 
-      // pPointTop = &WorkFrame[PPU_Scanline * NES_DISP_WIDTH];
-      pPointTop = WorkLine;
+      // pPointTop = &WorkFrame[nScanline * NES_DISP_WIDTH];
+      pPointTop = pwLine;
       InfoNES_MemorySet(pPointTop, 0, NES_DISP_WIDTH << 1);
     }
   }
 
+  byChrInLine = 0;
   util::WorkMeterMark(MARKER_BG);
 
   /*-------------------------------------------------------------------*/
@@ -1182,42 +1629,42 @@ void __not_in_flash_func(InfoNES_DrawLine)()
   /*-------------------------------------------------------------------*/
 
   /* MMC5 VROM switch */
-  MapperRenderScreen(0);
+  if (bMapperScreen)
+    MapperRenderScreen(0);
+  InfoNES_SyncChr(ppbyBank);
 
-  if (PPU_R1 & R1_SHOW_SP)
+  if (byR1 & R1_SHOW_SP)
   {
-    // Reset Scanline Sprite Count
-    PPU_R2 &= ~R2_MAX_SP;
+    // Sprites on this scanline
+    nSprCnt = pView->nSprCnt;
+    const BYTE *pbySprList = pView->pbySprList;
 
     // Reset sprite buffer
-    InfoNES_MemorySet(pSprBuf, 0, sizeof pSprBuf);
+    if (nSprCnt)
+      InfoNES_MemorySet(pSprBuf, 0, sizeof pSprBuf);
+    uint32_t dwSprGroups = 0;
 
-    const int patternTableIdSP88 = PPU_R0 & R0_SP_ADDR ? 1 : 0;
+    const int patternTableIdSP88 = byR0 & R0_SP_ADDR ? 1 : 0;
     const int bankOfsSP88 = patternTableIdSP88 << 2;
 
-    // Render a sprite to the sprite buffer
-    nSprCnt = 0;
-    for (pSPRRAM = SPRRAM + (63 << 2); pSPRRAM >= SPRRAM; pSPRRAM -= 4)
+    // Render a sprite to the sprite buffer ( sprite #0 last to be on top )
+    for (nIdx = (nSprCnt < SPR_LINE_MAX ? nSprCnt : SPR_LINE_MAX) - 1; nIdx >= 0; --nIdx)
     {
+      pSPRRAM = pbySprRam + pbySprList[nIdx];
       nY = pSPRRAM[SPR_Y] + 1;
-      if (nY > PPU_Scanline || nY + PPU_SP_Height <= PPU_Scanline)
-        continue; // Next sprite
 
       /*-------------------------------------------------------------------*/
       /*  A sprite in scanning line                                        */
       /*-------------------------------------------------------------------*/
 
-      // Holizontal Sprite Count +1
-      ++nSprCnt;
-
       nAttr = pSPRRAM[SPR_ATTR];
-      nYBit = PPU_Scanline - nY;
-      nYBit = (nAttr & SPR_ATTR_V_FLIP) ? (PPU_SP_Height - nYBit - 1) : nYBit;
+      nYBit = nScanline - nY;
+      nYBit = (nAttr & SPR_ATTR_V_FLIP) ? (nSPHeight - nYBit - 1) : nYBit;
       const int yOfsModSP = nYBit;
       nYBit <<= 3;
 
 #if 0
-      if (PPU_R0 & R0_SP_SIZE)
+      if (byR0 & R0_SP_SIZE)
       {
         // Sprite size 8x16
         if (pSPRRAM[SPR_CHR] & 1)
@@ -1283,7 +1730,7 @@ void __not_in_flash_func(InfoNES_DrawLine)()
       int ch = pSPRRAM[SPR_CHR];
 
       int bankOfs;
-      if (PPU_R0 & R0_SP_SIZE)
+      if (byR0 & R0_SP_SIZE)
       {
         // 8x16
         bankOfs = (ch & 1) << 2;
@@ -1296,50 +1743,49 @@ void __not_in_flash_func(InfoNES_DrawLine)()
       }
 
       const int bank = (ch >> 6) + bankOfs;
-      const int addrOfs = ((ch & 63) << 4) + ((yOfsModSP & 8) << 1) + (yOfsModSP & 7);
-      const auto data = PPUBANK[bank] + addrOfs;
-      const uint32_t pl0 = data[0];
-      const uint32_t pl1 = data[8];
-      const auto pat0 = ((pl0 & 0x55) << 24) | ((pl1 & 0x55) << 25);
-      const auto pat1 = ((pl0 & 0xaa) << 23) | ((pl1 & 0xaa) << 24);
+      const int rowOfs = ((ch & 63) << 3) + yOfsModSP;
+      const uint32_t pat = (uint32_t)ChrRows[bank][rowOfs] << 16;
 
       nAttr ^= SPR_ATTR_PRI;
       bySprCol = (nAttr & (SPR_ATTR_COLOR | SPR_ATTR_PRI)) << 2;
       nX = pSPRRAM[SPR_X];
       const auto dst = pSprBuf + nX;
 
+      // Groups of 8 dots to be composited ( dots past x = 255 are dropped )
+      dwSprGroups |= (nX & 7 ? 3u : 1u) << (nX >> 3);
+
       if (nAttr & SPR_ATTR_H_FLIP)
       {
         // h flip
-        if (int v = (pat1 << 0) >> 30)
+        if (int v = (pat << 0) >> 30)
         {
           dst[7] = bySprCol | v;
         }
-        if (int v = (pat0 << 0) >> 30)
+        if (int v = (pat << 2) >> 30)
         {
           dst[6] = bySprCol | v;
         }
-        if (int v = (pat1 << 2) >> 30)
+        if (int v = (pat << 4) >> 30)
         {
           dst[5] = bySprCol | v;
         }
-        if (int v = (pat0 << 2) >> 30)
+        if (int v = (pat << 6) >> 30)
         {
           dst[4] = bySprCol | v;
         }
-        if (int v = (pat1 << 4) >> 30)
+        if (int v = (pat << 8) >> 30)
         {
           dst[3] = bySprCol | v;
         }
-        if (int v = (pat0 << 4) >> 30)
+        if (int v = (pat << 10) >> 30)
         {
           dst[2] = bySprCol | v;
         }
-        if (int v = (pat1 << 6) >> 30)
+        if (int v = (pat << 12) >> 30)
         {
           dst[1] = bySprCol | v;
         }
-        if (int v = (pat0 << 6) >> 30)
+        if (int v = (pat << 14) >> 30)
         {
           dst[0] = bySprCol | v;
         }
@@ -1347,35 +1793,35 @@ void __not_in_flash_func(InfoNES_DrawLine)()
       else
       {
         // non flip
-        if (int v = (pat1 << 0) >> 30)
+        if (int v = (pat << 0) >> 30)
         {
           dst[0] = bySprCol | v;
         }
-        if (int v = (pat0 << 0) >> 30)
+        if (int v = (pat << 2) >> 30)
         {
           dst[1] = bySprCol | v;
         }
-        if (int v = (pat1 << 2) >> 30)
+        if (int v = (pat << 4) >> 30)
         {
           dst[2] = bySprCol | v;
         }
-        if (int v = (pat0 << 2) >> 30)
+        if (int v = (pat << 6) >> 30)
         {
           dst[3] = bySprCol | v;
         }
-        if (int v = (pat1 << 4) >> 30)
+        if (int v = (pat << 8) >> 30)
         {
           dst[4] = bySprCol | v;
         }
-        if (int v = (pat0 << 4) >> 30)
+        if (int v = (pat << 10) >> 30)
         {
           dst[5] = bySprCol | v;
         }
-        if (int v = (pat1 << 6) >> 30)
+        if (int v = (pat << 12) >> 30)
         {
           dst[6] = bySprCol | v;
         }
-        if (int v = (pat0 << 6) >> 30)
+        if (int v = (pat << 14) >> 30)
         {
           dst[7] = bySprCol | v;
         }
@@ -1384,14 +1830,15 @@ void __not_in_flash_func(InfoNES_DrawLine)()
     }
 
     // Rendering sprite
-    pPoint = WorkLine;
-    //   pPoint -= (NES_DISP_WIDTH - PPU_Scr_H_Bit);
+    pPoint = pwLine;
+    //   pPoint -= (NES_DISP_WIDTH - byScrHBit);
 
 #if 1
-    compositeSprite(PalTable + 0x10, pSprBuf, pPoint);
+    if (dwSprGroups)
+      compositeSprite(pwPalTable + 0x10, pSprBuf, pPoint, dwSprGroups);
 #else
     {
-      const auto *pal = &PalTable[0x10];
+      const auto *pal = &pwPalTable[0x10];
       const auto *spr = pSprBuf;
       const auto *sprEnd = spr + NES_DISP_WIDTH;
       //for (nX = 0; nX < NES_DISP_WIDTH; ++nX)
@@ -1426,22 +1873,254 @@ void __not_in_flash_func(InfoNES_DrawLine)()
     /*-------------------------------------------------------------------*/
     /*  Sprite Clipping                                                  */
     /*-------------------------------------------------------------------*/
-    if (!(PPU_R1 & R1_CLIP_SP))
+    if (!(byR1 & R1_CLIP_SP))
     {
       WORD *pPointTop;
 
-      // pPointTop = &WorkFrame[PPU_Scanline * NES_DISP_WIDTH];
-      pPointTop = WorkLine;
+      // pPointTop = &WorkFrame[nScanline * NES_DISP_WIDTH];
+      pPointTop = pwLine;
       InfoNES_MemorySet(pPointTop, 0, 8 << 1);
     }
 
-    if (nSprCnt >= 8)
-      PPU_R2 |= R2_MAX_SP; // Set a flag of maximum sprites on scanline
-
     util::WorkMeterMark(MARKER_SPRITE);
   }
 }
 
+/*===================================================================*/
+/*                                                                   */
+/*              InfoNES_DrawLine() : Render a scanline               */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_DrawLine)()
+{
+  /*
+ *  Render a scanline
+ *
+ *  Remarks
+ *    Draws the current PPU state into WorkLine.
+ */
+  struct InfoNES_LineView_tag view;
+
+  view.pwLine = WorkLine;
+  view.ppbyBank = PPUBANK;
+  view.pwPalTable = PalTable;
+  view.pbySprRam = SPRRAM;
+  view.pbySprList = SprLineList[PPU_Scanline];
+  view.nSprCnt = InfoNES_EvalSprLine();
+  view.wScanline = PPU_Scanline;
+  view.wAddr = PPU_Addr;
+  view.byR0 = PPU_R0;
+  view.byR1 = PPU_R1;
+  view.byScrHByte = PPU_Scr_H_Byte;
+  view.byScrHBit = PPU_Scr_H_Bit;
+  view.byUpDownClip = PPU_UpDown_Clip;
+
+  if (PPULogCnt)
+    InfoNES_RenderSplitLine(&view, PPULog, PPULogCnt);
+  else
+    InfoNES_RenderLine(&view);
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*   InfoNES_RenderSplitLine() : Render a scanline in segments       */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_RenderSplitLine)(const struct InfoNES_LineView_tag *pView,
+                                                 const struct InfoNES_PPULog_tag *pLog, int nLogCnt)
+{
+  /*
+ *  Render a scanline in segments split by the logged writes
+ *
+ *  Parameters
+ *    const struct InfoNES_LineView_tag *pView  (Read)
+ *      The PPU state at the end of the scanline
+ *
+ *    const struct InfoNES_PPULog_tag *pLog     (Read)
+ *      The writes in the scanline, in the order they were made
+ *
+ *    int nLogCnt                               (Read)
+ *      The number of the writes
+ *
+ *  Remarks
+ *    The scanline is drawn from the state at the end first. Then the
+ *    writes are undone from the last one, and each segment before a
+ *    write is drawn into SplitLine and copied over.
+ *    A segment shows the tiles as if its values had been set since the
+ *    left end ( the tile fetches of the PPU aren't emulated ). The
+ *    sprites are drawn from the sprite size and pattern table at the end.
+ */
+  struct InfoNES_LineView_tag view = *pView;
+  const struct InfoNES_PPULog_tag *pEntry;
+  int nIdx;
+  int nStart;
+  BYTE byPalUndone = 0;
+
+  InfoNES_RenderLine(pView);
+
+  InfoNES_MemoryCopy(SplitPalTable, pView->pwPalTable, sizeof SplitPalTable);
+  InfoNES_MemoryCopy(SplitBank, pView->ppbyBank, sizeof SplitBank);
+  view.pwLine = SplitLine;
+  view.pwPalTable = SplitPalTable;
+  view.ppbyBank = SplitBank;
+
+  for (nIdx = nLogCnt - 1; nIdx >= 0; --nIdx)
+  {
+    pEntry = &pLog[nIdx];
+
+    // Undo the write
+    switch (pEntry->byReg)
+    {
+    case PPU_LOG_R0:
+      // The sprites were fetched before the scanline
+      view.byR0 = (view.byR0 & ~R0_BG_ADDR) | (pEntry->wOld & R0_BG_ADDR);
+      break;
+
+    case PPU_LOG_R1:
+      view.byR1 = (BYTE)pEntry->wOld;
+      break;
+
+    case PPU_LOG_H_BIT:
+      view.byScrHBit = (BYTE)pEntry->wOld;
+      break;
+
+    case PPU_LOG_ADDR:
+      view.wAddr = pEntry->wOld;
+      view.byScrHByte = pEntry->wOld & 31;
+      break;
+
+    case PPU_LOG_PAL:
+      if (!(pEntry->byIdx & 0xf))
+      {
+        // Palette mirror
+        for (int nPal = 0; nPal < 32; nPal += 4)
+          SplitPalTable[nPal] = pEntry->wOld;
+        PalPairUpdate = 0xf;
+      }
+      else
+      {
+        SplitPalTable[pEntry->byIdx] = pEntry->wOld;
+        if (!(pEntry->byIdx & 0x10))
+          PalPairUpdate |= 1 << (pEntry->byIdx >> 2);
+      }
+      byPalUndone = 1;
+      break;
+
+    case PPU_LOG_BANK:
+      SplitBank[pEntry->byIdx] = pEntry->pbyOld;
+      break;
+    }
+
+    // The segment drawn before the write
+    nStart = nIdx > 0 ? pLog[nIdx - 1].wDot : 0;
+    if (nStart < pEntry->wDot)
+    {
+      InfoNES_RenderLine(&view);
+      InfoNES_MemoryCopy(pView->pwLine + nStart, SplitLine + nStart,
+                         (pEntry->wDot - nStart) << 1);
+    }
+  }
+
+  // The pair tables were made from an older palette
+  if (byPalUndone)
+    PalPairUpdate = 0xf;
+}
+
+/* Append a write to the log of the current scanline */
+static void __not_in_flash_func(InfoNES_LogAdd)(BYTE byReg, BYTE byIdx, WORD wOld, BYTE *pbyOld)
+{
+  struct InfoNES_PPULog_tag *pEntry;
+
+  // The dot the CPU is on ( EVENT_HSYNC is on dot 256 )
+  int nDot = NES_DISP_WIDTH - (int)(EventClock[EVENT_HSYNC] - K6502_GetClocks()) *
+                                  DOT_PER_SCANLINE / STEP_PER_SCANLINE;
+  if (nDot <= 0)
+    return; // In the H-Blank before the scanline
+  if (nDot > NES_DISP_WIDTH)
+    nDot = NES_DISP_WIDTH;
+
+  if (PPULogCnt == PPU_LOG_MAX)
+  {
+    // Too many, draw the scanline as a whole
+    PPULogOn = 0;
+    PPULogCnt = 0;
+    return;
+  }
+
+  pEntry = &PPULog[PPULogCnt++];
+  pEntry->wDot = nDot;
+  pEntry->byReg = byReg;
+  pEntry->byIdx = byIdx;
+  pEntry->wOld = wOld;
+  pEntry->pbyOld = pbyOld;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*   InfoNES_LogPPU() : Log a write in the middle of the scanline    */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_LogPPU)(BYTE byReg, BYTE byIdx, WORD wOld)
+{
+  /*
+ *  Log a write to the PPU in the middle of the scanline
+ *
+ *  Parameters
+ *    BYTE byReg                       (Read)
+ *      PPU_LOG_*
+ *
+ *    BYTE byIdx                       (Read)
+ *      Index of PalTable ( PPU_LOG_PAL )
+ *
+ *    WORD wOld                        (Read)
+ *      The value before the write
+ *
+ *  Remarks
+ *    Called by K6502_Write() while PPULogOn is set, before the write.
+ *    The CPU clocks of a scanline are spread over DOT_PER_SCANLINE dots
+ *    ending on dot 256, so a write in the H-Blank before the scanline
+ *    isn't logged but drawn as a whole.
+ */
+  InfoNES_LogAdd(byReg, byIdx, wOld, NULL);
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*   InfoNES_LogMapper() : Write to a mapper and log the banks       */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_LogMapper)(void (*pWrite)(WORD wAddr, BYTE byData),
+                                           WORD wAddr, BYTE byData)
+{
+  /*
+ *  Write to a mapper and log the banks it switched
+ *
+ *  Parameters
+ *    void (*pWrite)(WORD, BYTE)       (Read)
+ *      MapperWrite, MapperSram or MapperApu
+ *
+ *    WORD wAddr                       (Read)
+ *      Address to write
+ *
+ *    BYTE byData                      (Read)
+ *      Data to write
+ *
+ *  Remarks
+ *    The pattern tables and the name tables ( PPUBANK[0] - [11] ).
+ */
+  BYTE *pbyBank[12];
+  int nBank;
+
+  InfoNES_MemoryCopy(pbyBank, PPUBANK, sizeof pbyBank);
+  pWrite(wAddr, byData);
+
+  for (nBank = 0; nBank < 12 && PPULogOn; ++nBank)
+  {
+    if (PPUBANK[nBank] != pbyBank[nBank])
+      InfoNES_LogAdd(PPU_LOG_BANK, nBank, 0, pbyBank[nBank]);
+  }
+}
+
 /*===================================================================*/
 /*                                                                   */
 /* InfoNES_GetSprHitY() : Get a position of scanline hits sprite #0  */
@@ -1581,55 +2260,261 @@ void __not_in_flash_func(InfoNES_SetupChr)()
  *
  */
 
-#if 0
-  BYTE *pbyBGData;
-  BYTE byData1;
-  BYTE byData2;
-  int nIdx;
-  int nY;
-  int nOff;
-  static BYTE *pbyPrevBank[8];
+#if INFONES_RENDER_PIPE
+  // The cache belongs to core 1
+  if (RenderPipe)
+    return;
+#endif
+
+  // MMC2 and MMC4 switch the banks in the middle of a scanline
+  if (byChrInLine)
+    InfoNES_SyncChr(PPUBANK);
+}
+
+/*-------------------------------------------------------------------*/
+/*  Decoded pattern cache                                            */
+/*-------------------------------------------------------------------*/
+
+static inline WORD InfoNES_ChrRow(BYTE byPl0, BYTE byPl1)
+{
+  // Interleave the two planes : dot n gets bit 15-2n ( plane 1 ) and 14-2n ( plane 0 )
+  DWORD dwRow = byPl0 | (byPl1 << 16);
+  dwRow = (dwRow | (dwRow << 4)) & 0x0f0f0f0f;
+  dwRow = (dwRow | (dwRow << 2)) & 0x33333333;
+  dwRow = (dwRow | (dwRow << 1)) & 0x55555555;
+  return (WORD)(dwRow | (dwRow >> 15));
+}
+
+static void InfoNES_DecodeChr(struct ChrCache_tag *pCache, const BYTE *pbySrc)
+{
+  WORD *pwRow = pCache->wRows;
+
+  for (int nIdx = 0; nIdx < 64; ++nIdx, pbySrc += 16)
+  {
+    for (int nY = 0; nY < 8; ++nY)
+    {
+      *(pwRow++) = InfoNES_ChrRow(pbySrc[nY], pbySrc[nY + 8]);
+    }
+  }
+  ++ChrCacheDecodes;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*       InfoNES_SyncChr() : Bring the decoded pattern cache up      */
+/*                           to date with the pattern banks          */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_SyncChr)(BYTE *const *ppbyBank)
+{
+  /*
+ *  Bring the decoded pattern cache up to date
+ *
+ *  Parameters
+ *    BYTE *const *ppbyBank            (Read)
+ *      PPUBANK or the copy of the render pipeline
+ *
+ *  Remarks
+ *    Entries are keyed by the address of the 1KB page, so a bank switch
+ *    only costs a lookup when the page has been decoded before.
+ *    CHR-RAM writes keep the entries valid ( see InfoNES_ChrWrite() ).
+ *    Called before rendering, after MapperRenderScreen().
+ */
   int nBank;
+  int nIdx;
+  int nUsed;
 
   for (nBank = 0; nBank < 8; ++nBank)
   {
-    if (pbyPrevBank[nBank] == PPUBANK[nBank] && !((ChrBufUpdate >> nBank) & 1))
+    const BYTE *pbySrc = ppbyBank[nBank];
+    if (ChrCache[ChrCacheIdx[nBank]].pbySrc == pbySrc)
       continue; // Next bank
 
-    /*-------------------------------------------------------------------*/
-    /*  An address is different from the last time                       */
-    /*    or                                                             */
-    /*  An update flag is being set                                      */
-    /*-------------------------------------------------------------------*/
-
-    for (nIdx = 0; nIdx < 64; ++nIdx)
+    // Look for the page
+    for (nIdx = 0; nIdx < CHR_CACHE_PAGES; ++nIdx)
     {
-      nOff = (nBank << 12) + (nIdx << 6);
+      if (ChrCache[nIdx].pbySrc == pbySrc)
+        break;
+    }
 
-      for (nY = 0; nY < 8; ++nY)
+    if (nIdx == CHR_CACHE_PAGES)
+    {
+      // Evict an entry that no other bank points to
+      for (;;)
       {
-        pbyBGData = PPUBANK[nBank] + (nIdx << 4) + nY;
+        nIdx = nChrCacheNext;
+        nChrCacheNext = (nChrCacheNext + 1) % CHR_CACHE_PAGES;
 
-        byData1 = ((pbyBGData[0] >> 1) & 0x55) | (pbyBGData[8] & 0xAA);
-        byData2 = (pbyBGData[0] & 0x55) | ((pbyBGData[8] << 1) & 0xAA);
+        for (nUsed = 0; nUsed < 8; ++nUsed)
+        {
+          if (nUsed != nBank && ChrCacheIdx[nUsed] == nIdx &&
+              ChrCache[nIdx].pbySrc == ppbyBank[nUsed])
+            break;
+        }
+        if (nUsed == 8)
+          break;
+      }
+      ChrCache[nIdx].pbySrc = pbySrc;
+      InfoNES_DecodeChr(&ChrCache[nIdx], pbySrc);
+    }
 
-        ChrBuf[nOff] = (byData1 >> 6) & 3;
-        ChrBuf[nOff + 1] = (byData2 >> 6) & 3;
-        ChrBuf[nOff + 2] = (byData1 >> 4) & 3;
-        ChrBuf[nOff + 3] = (byData2 >> 4) & 3;
-        ChrBuf[nOff + 4] = (byData1 >> 2) & 3;
-        ChrBuf[nOff + 5] = (byData2 >> 2) & 3;
-        ChrBuf[nOff + 6] = byData1 & 3;
-        ChrBuf[nOff + 7] = byData2 & 3;
+    ChrCacheIdx[nBank] = nIdx;
+    ChrRows[nBank] = ChrCache[nIdx].wRows;
+  }
+}
 
-        nOff += 8;
-      }
+/*===================================================================*/
+/*                                                                   */
+/*          InfoNES_IsVRom() : Is a PPUBANK page in VROM ?           */
+/*                                                                   */
+/*===================================================================*/
+int __not_in_flash_func(InfoNES_IsVRom)(const BYTE *pbyPage)
+{
+  /*
+ *  Is a PPUBANK page in VROM ?
+ *
+ *  Parameters
+ *    const BYTE *pbyPage              (Read)
+ *      The page
+ *
+ *  Return values
+ *    1 : VROM, the PPU ignores a write to it
+ *    0 : PPU RAM or a mapper's own memory
+ */
+  const uintptr_t nOfs = (uintptr_t)pbyPage - (uintptr_t)VROM;
+  return nOfs < NesHeader.byVRomSize * 0x2000u;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*     InfoNES_ChrWrite() : Update the decoded row of a CHR-RAM byte */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_ChrWrite)(WORD wAddr)
+{
+  /*
+ *  Update the decoded row of a CHR-RAM byte
+ *
+ *  Parameters
+ *    WORD wAddr                       (Read)
+ *      PPU address ( 0x0000 - 0x1fff ), already written to PPUBANK
+ *
+ *  Remarks
+ *    Only the row is decoded again instead of dropping the whole page.
+ */
+  const BYTE *pbySrc = PPUBANK[wAddr >> 10];
+  const BYTE *pbyRow = pbySrc + (wAddr & 0x3f7);
+  const int nRow = ((wAddr & 0x3f0) >> 1) + (wAddr & 7);
+  struct ChrCache_tag *pCache = &ChrCache[ChrCacheIdx[wAddr >> 10]];
+
+  if (pCache->pbySrc != pbySrc)
+  {
+    // The bank was switched since the last rendering
+    InfoNES_ChrPageWrite(pbySrc, wAddr & 0x3ff);
+    return;
+  }
+  pCache->wRows[nRow] = InfoNES_ChrRow(pbyRow[0], pbyRow[8]);
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*  InfoNES_ChrPageWrite() : Update the decoded row of a byte        */
+/*                           in a 1KB page                           */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_ChrPageWrite)(const BYTE *pbySrc, WORD wOfs)
+{
+  /*
+ *  Update the decoded row of a byte in a 1KB page
+ *
+ *  Parameters
+ *    const BYTE *pbySrc               (Read)
+ *      The page, already written to
+ *
+ *    WORD wOfs                        (Read)
+ *      Offset in the page ( 0x000 - 0x3ff )
+ *
+ *  Remarks
+ *    Nothing is done when the page isn't in the cache.
+ */
+  const BYTE *pbyRow = pbySrc + (wOfs & 0x3f7);
+  const int nRow = ((wOfs & 0x3f0) >> 1) + (wOfs & 7);
+  struct ChrCache_tag *pCache;
+
+  for (pCache = ChrCache; pCache < &ChrCache[CHR_CACHE_PAGES]; ++pCache)
+  {
+    if (pCache->pbySrc == pbySrc)
+    {
+      pCache->wRows[nRow] = InfoNES_ChrRow(pbyRow[0], pbyRow[8]);
+      return;
     }
-    // Keep this address
-    pbyPrevBank[nBank] = PPUBANK[nBank];
   }
+}
 
-  // Reset update flag
-  ChrBufUpdate = 0;
-#endif
+/*===================================================================*/
+/*                                                                   */
+/*   InfoNES_AttrWrite() : Update the palettes of an attribute byte  */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_AttrWrite)(const BYTE *pbySrc, WORD wOfs)
+{
+  /*
+ *  Update the palettes of the tiles of an attribute byte
+ *
+ *  Parameters
+ *    const BYTE *pbySrc               (Read)
+ *      The 1KB name table, already written to
+ *
+ *    WORD wOfs                        (Read)
+ *      Offset in the name table ( 0x000 - 0x3ff )
+ *
+ *  Remarks
+ *    Nothing is done for a tile or when the name table isn't cached.
+ */
+  struct AttrCache_tag *pCache;
+  int nY;
+  int nX;
+
+  if ((wOfs & 0x3c0) != 0x3c0)
+    return;
+
+  for (pCache = AttrCache; pCache < &AttrCache[ATTR_CACHE_PAGES]; ++pCache)
+  {
+    if (pCache->pbySrc == pbySrc)
+      break;
+  }
+  if (pCache == &AttrCache[ATTR_CACHE_PAGES])
+    return;
+
+  // 4 x 4 tiles
+  const int nByte = pbySrc[wOfs];
+  const int nTop = (wOfs & 0x38) >> 1;
+  const int nLeft = (wOfs & 0x07) << 2;
+  for (nY = nTop; nY < nTop + 4; ++nY)
+  {
+    for (nX = nLeft; nX < nLeft + 4; ++nX)
+      pCache->byAttr[(nY << 5) + nX] = (nByte >> ((nX & 2) + ((nY & 2) << 1))) & 3;
+  }
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*   InfoNES_ResetRender() : Drop what the renderer has cached       */
+/*                                                                   */
+/*===================================================================*/
+void InfoNES_ResetRender()
+{
+  /*
+ *  Drop what the renderer has cached
+ *
+ *  Remarks
+ *    The decoded pattern cache, the BG tile palettes and the palette
+ *    pair tables are made again from the memory they are drawn from
+ *    next time.
+ */
+  InfoNES_MemorySet(ChrCache, 0, sizeof ChrCache);
+  nChrCacheNext = 0;
+  InfoNES_MemorySet(AttrCache, 0, sizeof AttrCache);
+  nAttrCacheNext = 0;
+  PalPairUpdate = 0xf;
 }
@@ -72,6 +72,12 @@ extern BYTE *PPUBANK[];
 /* Sprite RAM */
 extern BYTE SPRRAM[];
 
+/* Update flag for the sprite line lists ( set by $2004 and $4014 ) */
+extern BYTE SprLineUpdate;
+
+/* Sprites shown on a scanline */
+#define SPR_LINE_MAX 8
+
 #define SPR_Y 0
 #define SPR_CHR 1
 #define SPR_ATTR 2
@@ -149,6 +155,7 @@ extern BYTE PPU_UpDown_Clip;
 // #define STEP_PER_FRAME 29828
 #define STEP_PER_SCANLINE 114 // 113.66
 #define STEP_PER_FRAME 29780 // 29780.5
+#define DOT_PER_SCANLINE 341 // EVENT_HSYNC is on dot 256
 
 /* Develop Scroll Registers */
 #if 0
@@ -177,11 +184,11 @@ extern BYTE PPU_ScanTable[];
 /* Name Table Bank */
 extern BYTE PPU_NameTableBank;
 
-/* BG Base Address */
-extern BYTE *PPU_BG_Base;
+/* BG Base Address ( in the pattern tables ) */
+extern WORD PPU_BG_Base;
 
-/* Sprite Base Address */
-extern BYTE *PPU_SP_Base;
+/* Sprite Base Address ( in the pattern tables ) */
+extern WORD PPU_SP_Base;
 
 /* Sprite Height */
 extern WORD PPU_SP_Height;
@@ -190,12 +197,63 @@ extern WORD PPU_SP_Height;
 #define NES_DISP_WIDTH 256
 #define NES_DISP_HEIGHT 240
 
+/* The PPU state a scanline is drawn from */
+struct InfoNES_LineView_tag
+{
+  WORD *pwLine;        /* Line buffer */
+  BYTE *const *ppbyBank; /* PPUBANK */
+  WORD *pwPalTable;    /* PalTable */
+  BYTE *pbySprRam;     /* SPRRAM */
+  const BYTE *pbySprList; /* Sprites on the scanline ( SPRRAM offsets ) */
+  int nSprCnt;         /* The number of sprites on the scanline */
+  WORD wScanline;      /* PPU_Scanline */
+  WORD wAddr;          /* PPU_Addr */
+  BYTE byR0;           /* PPU_R0 */
+  BYTE byR1;           /* PPU_R1 */
+  BYTE byScrHByte;     /* PPU_Scr_H_Byte */
+  BYTE byScrHBit;      /* PPU_Scr_H_Bit */
+  BYTE byUpDownClip;   /* PPU_UpDown_Clip */
+};
+
+/* A write in the middle of a scanline ( see InfoNES_LogPPU() ) */
+struct InfoNES_PPULog_tag
+{
+  WORD wDot;    /* The first dot drawn with the new value */
+  BYTE byReg;   /* PPU_LOG_* */
+  BYTE byIdx;   /* Index of PalTable or PPUBANK */
+  WORD wOld;    /* The value before the write */
+  BYTE *pbyOld; /* The bank before the write */
+};
+
+#define PPU_LOG_R0 0    /* wOld : PPU_R0 ( only R0_BG_ADDR is undone ) */
+#define PPU_LOG_R1 1    /* wOld : PPU_R1 */
+#define PPU_LOG_H_BIT 2 /* wOld : PPU_Scr_H_Bit */
+#define PPU_LOG_ADDR 3  /* wOld : PPU_Addr */
+#define PPU_LOG_PAL 4   /* wOld : PalTable[ byIdx ] ( 0x00 : with the mirrors ) */
+#define PPU_LOG_BANK 5  /* pbyOld : PPUBANK[ byIdx ] */
+
+/* Writes logged in a scanline at most ( the rest is drawn as a whole ) */
+#define PPU_LOG_MAX 32
+
+/* Writes to the PPU are logged ( the current scanline is drawn ) */
+extern BYTE PPULogOn;
+
 /* VRAM Write Enable ( 0: Disable, 1: Enable ) */
 extern BYTE byVramWriteEnable;
 
 /* Frame IRQ ( 0: Disabled, 1: Enabled )*/
 extern BYTE FrameIRQ_Enable;
-extern WORD FrameStep;
+
+/*-------------------------------------------------------------------*/
+/*  Event resources                                                  */
+/*-------------------------------------------------------------------*/
+
+/* Events ( taken in this order at the same clock ) */
+#define EVENT_SPRITE_HIT 0 /* Sprite #0 hit */
+#define EVENT_FRAME_IRQ 1  /* Frame IRQ */
+#define EVENT_MAPPER 2     /* Mapper IRQ counter ( MapperEvent ) */
+#define EVENT_HSYNC 3      /* End of a scanline */
+#define EVENT_COUNT 4
 
 /*-------------------------------------------------------------------*/
 /*  Display and Others resouces                                      */
@@ -214,12 +272,26 @@ extern WORD WorkFrameIdx;
 extern WORD WorkFrame[NES_DISP_WIDTH * NES_DISP_HEIGHT];
 #endif
 
-extern BYTE ChrBuf[];
+/* Line buffer set by InfoNES_SetLineBuffer() */
+extern WORD *WorkLine;
+
+/* Decoded pattern cache ( 1KB pages, about 1KB of RAM each, 8 at least ) */
+#ifndef CHR_CACHE_PAGES
+#define CHR_CACHE_PAGES 16
+#endif
 
-extern BYTE ChrBufUpdate;
+/* The number of pages decoded into the cache */
+extern DWORD ChrCacheDecodes;
+
+/* Name tables with the palette of each BG tile ( 1KB of RAM each, 2 at least ) */
+#ifndef ATTR_CACHE_PAGES
+#define ATTR_CACHE_PAGES 4
+#endif
 
 extern WORD PalTable[];
 
+extern BYTE PalPairUpdate;
+
 /*-------------------------------------------------------------------*/
 /*  APU and Pad resources                                            */
 /*-------------------------------------------------------------------*/
@@ -261,11 +333,21 @@ extern BYTE (*MapperReadApu)(WORD wAddr);
 extern void (*MapperVSync)();
 /* Callback at HSync */
 extern void (*MapperHSync)();
+/* Callback at EVENT_MAPPER */
+extern void (*MapperEvent)();
 /* Callback at PPU read/write */
 extern void (*MapperPPU)(WORD wAddr);
 /* Callback at Rendering Screen 1:BG, 0:Sprite */
 extern void (*MapperRenderScreen)(BYTE byMode);
 
+/* Callbacks which aren't the Map0 no-ops ( set after MapperInit ) */
+extern BYTE MapperHooks;
+
+#define MAPPER_HOOK_VSYNC 1
+#define MAPPER_HOOK_HSYNC 2
+#define MAPPER_HOOK_PPU 4
+#define MAPPER_HOOK_RENDER_SCREEN 8
+
 /*-------------------------------------------------------------------*/
 /*  ROM information                                                  */
 /*-------------------------------------------------------------------*/
@@ -293,6 +375,25 @@ extern BYTE ROM_SRAM;
 extern BYTE ROM_Trainer;
 extern BYTE ROM_FourScr;
 
+/*-------------------------------------------------------------------*/
+/*  Work meter markers                                               */
+/*-------------------------------------------------------------------*/
+
+/* Tags are RGB555 colors of the on-screen work meter */
+constexpr WORD InfoNES_MarkerTag(int r, int g, int b)
+{
+  return (r << 10) | (g << 5) | (b);
+}
+
+enum
+{
+  MARKER_START = InfoNES_MarkerTag(0, 31, 31),
+  MARKER_CPU = InfoNES_MarkerTag(0, 31, 0),
+  MARKER_SOUND = InfoNES_MarkerTag(31, 31, 0),
+  MARKER_BG = InfoNES_MarkerTag(0, 0, 31),
+  MARKER_SPRITE = InfoNES_MarkerTag(31, 0, 0),
+};
+
 /*-------------------------------------------------------------------*/
 /*  Function prototypes                                              */
 /*-------------------------------------------------------------------*/
@@ -321,18 +422,58 @@ void InfoNES_Main();
 /* The loop of emulation */
 void InfoNES_Cycle();
 
+/* Set an event at a CPU clock ( K6502_GetClocks ) */
+void InfoNES_SetEvent(int nEvent, DWORD dwClock);
+
+/* Cancel an event */
+void InfoNES_ClearEvent(int nEvent);
+
 /* A function in H-Sync */
 int InfoNES_HSync();
 
 /* Render a scanline */
 void InfoNES_DrawLine();
 
+/* Render a scanline from a view */
+void InfoNES_RenderLine(const struct InfoNES_LineView_tag *pView);
+
+/* Render a scanline in segments split by the logged writes */
+void InfoNES_RenderSplitLine(const struct InfoNES_LineView_tag *pView,
+                             const struct InfoNES_PPULog_tag *pLog, int nLogCnt);
+
+/* Log a write to the PPU in the middle of the scanline */
+void InfoNES_LogPPU(BYTE byReg, BYTE byIdx, WORD wOld);
+
+/* Write to a mapper and log the banks it switched */
+void InfoNES_LogMapper(void (*pWrite)(WORD wAddr, BYTE byData), WORD wAddr, BYTE byData);
+
+/* Go through a scanline without drawing */
+void InfoNES_SkipLine();
+
 /* Get a position of scanline hits sprite #0 */
 void InfoNES_GetSprHitY();
 
 /* Develop character data */
 void InfoNES_SetupChr();
 
+/* Bring the decoded pattern cache up to date */
+void InfoNES_SyncChr(BYTE *const *ppbyBank);
+
+/* Is a PPUBANK page in VROM ? */
+int InfoNES_IsVRom(const BYTE *pbyPage);
+
+/* Update the decoded row of a CHR-RAM byte */
+void InfoNES_ChrWrite(WORD wAddr);
+
+/* Update the decoded row of a byte in a 1KB page */
+void InfoNES_ChrPageWrite(const BYTE *pbySrc, WORD wOfs);
+
+/* Update the palettes of the tiles of an attribute byte */
+void InfoNES_AttrWrite(const BYTE *pbySrc, WORD wOfs);
+
+/* Drop what the renderer has cached */
+void InfoNES_ResetRender();
+
 void InfoNES_SetLineBuffer(WORD *p, WORD size);
 
 #endif /* !InfoNES_H_INCLUDED */
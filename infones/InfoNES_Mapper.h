@@ -42,8 +42,6 @@ extern BYTE DRAM[];
 #define CRAMPAGE(a) &PPURAM[0x0000 + ((a)&0x1F) * 0x400]
 /* The address of 1Kbytes unit of the VRAM */
 #define VRAMPAGE(a) &PPURAM[0x2000 + (a)*0x400]
-/* Translate the pointer to ChrBuf into the address of Pattern Table */
-#define PATTBL(a) (((a)-ChrBuf) >> 2)
 
 /*-------------------------------------------------------------------*/
 /*  Table of Mapper initialize function                              */
@@ -139,7 +137,9 @@ void Map19_Init();
 void Map19_Write(WORD wAddr, BYTE byData);
 void Map19_Apu(WORD wAddr, BYTE byData);
 BYTE Map19_ReadApu(WORD wAddr);
-void Map19_HSync();
+void Map19_Event();
+void Map19_Sync_IRQ();
+void Map19_Set_IRQ();
 
 void Map21_Init();
 void Map21_Write(WORD wAddr, BYTE byData);
@@ -277,7 +277,9 @@ void Map68_SyncMirror();
 
 void Map69_Init();
 void Map69_Write(WORD wAddr, BYTE byData);
-void Map69_HSync();
+void Map69_Event();
+void Map69_Sync_IRQ();
+void Map69_Set_IRQ();
 
 void Map70_Init();
 void Map70_Write(WORD wAddr, BYTE byData);
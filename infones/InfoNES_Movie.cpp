@@ -0,0 +1,294 @@
+/*===================================================================*/
+/*                                                                   */
+/*  InfoNES_Movie.cpp : Input movie recording and playback           */
+/*                                                                   */
+/*===================================================================*/
+
+/*-------------------------------------------------------------------*/
+/*  Include files                                                    */
+/*-------------------------------------------------------------------*/
+
+#include "InfoNES_Movie.h"
+#include "InfoNES.h"
+#include "InfoNES_System.h"
+#include "K6502.h"
+#include <string.h>
+
+/*-------------------------------------------------------------------*/
+/*  Movie resources                                                  */
+/*-------------------------------------------------------------------*/
+
+/* Current mode */
+BYTE MovieMode = MOVIE_OFF;
+
+/* The number of frames recorded or played */
+int MovieFrame;
+
+/* The number of frames in the movie being played */
+int MovieLength;
+
+/* The first frame whose hash didn't match ( -1 : none ) */
+int MovieDesyncFrame = -1;
+
+/* Movie buffer */
+static BYTE *pbyMovieBuf;
+static const BYTE *pbyMovieData;
+static int nMovieSize;
+static int nMoviePos;
+static int nMovieHashInterval;
+
+static const BYTE MovieMagic[4] = {'I', 'N', 'M', 'V'};
+
+/*-------------------------------------------------------------------*/
+/*  FNV-1a                                                           */
+/*-------------------------------------------------------------------*/
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+static uint64_t HashBytes(uint64_t h, const void *pData, int nSize)
+{
+  const BYTE *p = (const BYTE *)pData;
+  while (nSize--)
+  {
+    h = (h ^ *p++) * FNV_PRIME;
+  }
+  return h;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*      InfoNES_StateHash() : Get a hash value of the state          */
+/*                                                                   */
+/*===================================================================*/
+uint64_t InfoNES_StateHash()
+{
+  /*
+ *  Get a hash value of the emulation state
+ *
+ *  Remarks
+ *    RAM, PPU RAM, Sprite RAM, palette and CPU registers.
+ *    It must be called between K6502_Run() calls.
+ */
+  struct K6502_Regs_tag regs;
+  BYTE byRegs[7];
+
+  K6502_GetRegs(&regs);
+  byRegs[0] = regs.PC & 0xff;
+  byRegs[1] = regs.PC >> 8;
+  byRegs[2] = regs.SP;
+  byRegs[3] = regs.F;
+  byRegs[4] = regs.A;
+  byRegs[5] = regs.X;
+  byRegs[6] = regs.Y;
+
+  uint64_t h = FNV_OFFSET;
+  h = HashBytes(h, RAM, RAM_SIZE);
+  h = HashBytes(h, PPURAM, PPURAM_SIZE);
+  h = HashBytes(h, SPRRAM, SPRRAM_SIZE);
+  h = HashBytes(h, PalTable, sizeof(WORD) * 32);
+  h = HashBytes(h, byRegs, sizeof byRegs);
+  return h;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*         InfoNES_MovieRecord() : Start recording a movie           */
+/*                                                                   */
+/*===================================================================*/
+void InfoNES_MovieRecord(BYTE *pbyBuf, int nSize, int nHashInterval)
+{
+  /*
+ *  Start recording into a buffer
+ *
+ *  Parameters
+ *    BYTE *pbyBuf             (Write)
+ *      Movie buffer
+ *
+ *    int nSize                (Read)
+ *      Size of the buffer
+ *
+ *    int nHashInterval        (Read)
+ *      Frames between state hashes ( 0 : no hash )
+ *
+ *  Remarks
+ *    Call this just after InfoNES_Reset().
+ *    Recording stops when the buffer is full.
+ */
+  MovieMode = MOVIE_OFF;
+  if (nSize < MOVIE_HEADER_SIZE)
+    return;
+
+  memcpy(pbyBuf, MovieMagic, sizeof MovieMagic);
+  pbyBuf[4] = MOVIE_VERSION;
+  pbyBuf[5] = 0;
+  pbyBuf[6] = nHashInterval & 0xff;
+  pbyBuf[7] = (nHashInterval >> 8) & 0xff;
+
+  pbyMovieBuf = pbyBuf;
+  pbyMovieData = pbyBuf;
+  nMovieSize = nSize;
+  nMoviePos = MOVIE_HEADER_SIZE;
+  nMovieHashInterval = nHashInterval & 0xffff;
+
+  MovieFrame = 0;
+  MovieLength = 0;
+  MovieDesyncFrame = -1;
+  MovieMode = MOVIE_RECORD;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*           InfoNES_MoviePlay() : Start playback of a movie         */
+/*                                                                   */
+/*===================================================================*/
+int InfoNES_MoviePlay(const BYTE *pbyBuf, int nSize)
+{
+  /*
+ *  Start playback of a movie
+ *
+ *  Return values
+ *     0 : Normally
+ *    -1 : Not a movie
+ *
+ *  Remarks
+ *    Call this just after InfoNES_Reset().
+ *    The joypad state is replaced until the end of the movie.
+ */
+  int nFrameSize;
+
+  MovieMode = MOVIE_OFF;
+  if (nSize < MOVIE_HEADER_SIZE ||
+      memcmp(pbyBuf, MovieMagic, sizeof MovieMagic) != 0 ||
+      pbyBuf[4] != MOVIE_VERSION)
+  {
+    InfoNES_MessageBox("Invalid movie.");
+    return -1;
+  }
+
+  pbyMovieBuf = NULL;
+  pbyMovieData = pbyBuf;
+  nMovieSize = nSize;
+  nMoviePos = MOVIE_HEADER_SIZE;
+  nMovieHashInterval = pbyBuf[6] | (pbyBuf[7] << 8);
+
+  // Count the frames
+  nSize -= MOVIE_HEADER_SIZE;
+  MovieLength = 0;
+  if (nMovieHashInterval)
+  {
+    nFrameSize = MOVIE_RECORD_SIZE * nMovieHashInterval + MOVIE_HASH_SIZE;
+    MovieLength = nSize / nFrameSize * nMovieHashInterval;
+    nSize %= nFrameSize;
+  }
+  MovieLength += nSize / MOVIE_RECORD_SIZE;
+
+  MovieFrame = 0;
+  MovieDesyncFrame = -1;
+  MovieMode = MOVIE_PLAY;
+  return 0;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*        InfoNES_MovieStop() : Stop recording or playback           */
+/*                                                                   */
+/*===================================================================*/
+int InfoNES_MovieStop()
+{
+  /*
+ *  Stop recording or playback
+ *
+ *  Return values
+ *    Size of the recorded movie in bytes ( 0 : not recording )
+ */
+  int nSize = MovieMode == MOVIE_RECORD ? nMoviePos : 0;
+  MovieMode = MOVIE_OFF;
+  return nSize;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*     InfoNES_MovieSync() : Record or replace the joypad state      */
+/*                                                                   */
+/*===================================================================*/
+void InfoNES_MovieSync(DWORD *pdwPad1, DWORD *pdwPad2, DWORD *pdwSystem)
+{
+  /*
+ *  Record or replace the joypad state
+ *
+ *  Parameters
+ *    DWORD *pdwPad1                   (Read/Write)
+ *      Joypad 1 State
+ *
+ *    DWORD *pdwPad2                   (Read/Write)
+ *      Joypad 2 State
+ *
+ *    DWORD *pdwSystem                 (Read/Write)
+ *      Input for InfoNES
+ *
+ *  Remarks
+ *    Called once per V-Blank just after InfoNES_PadState().
+ */
+  BYTE *pbyHash;
+  uint64_t hash;
+  int i;
+
+  if (MovieMode == MOVIE_RECORD)
+  {
+    if (nMoviePos + MOVIE_RECORD_SIZE + MOVIE_HASH_SIZE > nMovieSize)
+    {
+      InfoNES_MessageBox("Movie buffer is full.");
+      MovieMode = MOVIE_OFF;
+      return;
+    }
+
+    pbyMovieBuf[nMoviePos++] = *pdwPad1 & 0xff;
+    pbyMovieBuf[nMoviePos++] = *pdwPad2 & 0xff;
+    pbyMovieBuf[nMoviePos++] = *pdwSystem & 0xff;
+    ++MovieFrame;
+
+    if (nMovieHashInterval && MovieFrame % nMovieHashInterval == 0)
+    {
+      hash = InfoNES_StateHash();
+      pbyHash = &pbyMovieBuf[nMoviePos];
+      for (i = 0; i < MOVIE_HASH_SIZE; ++i)
+        pbyHash[i] = (BYTE)(hash >> (i * 8));
+      nMoviePos += MOVIE_HASH_SIZE;
+    }
+  }
+  else if (MovieMode == MOVIE_PLAY)
+  {
+    if (MovieFrame >= MovieLength)
+    {
+      // End of the movie
+      MovieMode = MOVIE_OFF;
+      return;
+    }
+
+    *pdwPad1 = pbyMovieData[nMoviePos++];
+    *pdwPad2 = pbyMovieData[nMoviePos++];
+    // The live QUIT button is kept so that the playback can be stopped
+    *pdwSystem = pbyMovieData[nMoviePos++] | (*pdwSystem & PAD_SYS_QUIT);
+    ++MovieFrame;
+
+    if (nMovieHashInterval && MovieFrame % nMovieHashInterval == 0)
+    {
+      hash = 0;
+      pbyHash = (BYTE *)&pbyMovieData[nMoviePos];
+      for (i = 0; i < MOVIE_HASH_SIZE; ++i)
+        hash |= (uint64_t)pbyHash[i] << (i * 8);
+      nMoviePos += MOVIE_HASH_SIZE;
+
+      if (MovieDesyncFrame < 0 && hash != InfoNES_StateHash())
+      {
+        MovieDesyncFrame = MovieFrame;
+        InfoNES_MessageBox("Movie desync at frame %d.", MovieFrame);
+      }
+    }
+  }
+}
+
+/*
+ * End of InfoNES_Movie.cpp
+ */
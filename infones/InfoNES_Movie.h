@@ -0,0 +1,80 @@
+/*===================================================================*/
+/*                                                                   */
+/*  InfoNES_Movie.h : Input movie recording and playback             */
+/*                                                                   */
+/*===================================================================*/
+
+#ifndef InfoNES_MOVIE_H_INCLUDED
+#define InfoNES_MOVIE_H_INCLUDED
+
+/*-------------------------------------------------------------------*/
+/*  Include files                                                    */
+/*-------------------------------------------------------------------*/
+
+#include "InfoNES_Types.h"
+#include <stdint.h>
+
+/*-------------------------------------------------------------------*/
+/*  Movie format                                                     */
+/*-------------------------------------------------------------------*/
+
+/*
+ *  Header ( 8 bytes )
+ *    0 - 3 : "INMV"
+ *    4     : Version
+ *    5     : Reserved
+ *    6 - 7 : Hash interval in frames ( little endian, 0: no hash )
+ *
+ *  Followed by one record per V-Blank
+ *    0     : Pad1
+ *    1     : Pad2
+ *    2     : System
+ *  and, after every "hash interval" records, the 64bit state hash
+ *  ( little endian ).
+ */
+#define MOVIE_HEADER_SIZE 8
+#define MOVIE_RECORD_SIZE 3
+#define MOVIE_HASH_SIZE 8
+#define MOVIE_VERSION 1
+
+/* Movie mode */
+#define MOVIE_OFF 0
+#define MOVIE_RECORD 1
+#define MOVIE_PLAY 2
+
+/*-------------------------------------------------------------------*/
+/*  Movie resources                                                  */
+/*-------------------------------------------------------------------*/
+
+/* Current mode */
+extern BYTE MovieMode;
+
+/* The number of frames recorded or played */
+extern int MovieFrame;
+
+/* The number of frames in the movie being played */
+extern int MovieLength;
+
+/* The first frame whose hash didn't match ( -1 : none ) */
+extern int MovieDesyncFrame;
+
+/*-------------------------------------------------------------------*/
+/*  Function prototypes                                              */
+/*-------------------------------------------------------------------*/
+
+/* Start recording into a buffer */
+void InfoNES_MovieRecord(BYTE *pbyBuf, int nSize, int nHashInterval);
+
+/* Start playback of a movie */
+int InfoNES_MoviePlay(const BYTE *pbyBuf, int nSize);
+
+/* Stop recording or playback */
+int InfoNES_MovieStop();
+
+/* Record or replace the joypad state ( once per V-Blank ) */
+void InfoNES_MovieSync(DWORD *pdwPad1, DWORD *pdwPad2, DWORD *pdwSystem);
+
+/* Get a hash value of the emulation state */
+uint64_t InfoNES_StateHash();
+
+#endif /* !InfoNES_MOVIE_H_INCLUDED */
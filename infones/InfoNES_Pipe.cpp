@@ -0,0 +1,564 @@
+/*===================================================================*/
+/*                                                                   */
+/*  InfoNES_Pipe.cpp : Render pipeline ( scanlines drawn by core 1 ) */
+/*                                                                   */
+/*===================================================================*/
+
+/*
+ *  Core 0 runs the CPU and the APU and, instead of drawing, puts the
+ *  scanlines into a single-producer / single-consumer ring :
+ *
+ *    - every write to the pattern tables, the name tables, the palette
+ *      and Sprite RAM, in the order the CPU made them
+ *    - PPUBANK entries changed since the last scanline
+ *    - the writes in the middle of the scanline ( InfoNES_LogPPU() )
+ *    - the registers and the sprites of the scanline itself
+ *
+ *  Core 1 replays the writes on its own copy of PPU RAM, the palette
+ *  and Sprite RAM, and draws the scanlines from the copy with
+ *  InfoNES_RenderLine(), so the frames are the same as drawn in place.
+ *
+ *  The decoded pattern cache and the palette pair tables belong to
+ *  core 1 while the pipeline runs.
+ *  Mappers which watch the rendering ( MapperPPU, MapperRenderScreen )
+ *  are drawn in place. A write to a mapper's own PPU memory draws in
+ *  place until the next V-Blank.
+ */
+
+/*-------------------------------------------------------------------*/
+/*  Include files                                                    */
+/*-------------------------------------------------------------------*/
+
+#include "InfoNES_Pipe.h"
+
+#if INFONES_RENDER_PIPE
+
+#include "InfoNES.h"
+#include "InfoNES_System.h"
+#include "InfoNES_Mapper.h"
+#include <atomic>
+#include <stdint.h>
+#include <pico.h>
+
+/*-------------------------------------------------------------------*/
+/*  Commands                                                         */
+/*-------------------------------------------------------------------*/
+
+/* PPU RAM [ wAddr ] = byData, pattern data */
+#define PIPE_CHR 0
+/* PPU RAM [ wAddr ] = byData, name table */
+#define PIPE_VRAM 1
+/* PalTable [ wAddr ] = dwData */
+#define PIPE_PAL 2
+/* Sprite RAM [ wAddr ] = byData */
+#define PIPE_OAM 3
+/* Sprite RAM [ wAddr ... wAddr + 3 ] = dwData */
+#define PIPE_OAM4 4
+/* Sprite list [ byData ... byData + 3 ] = dwData */
+#define PIPE_SPR 5
+/* PPUBANK [ byData ] = pPtr */
+#define PIPE_BANK 6
+/* Draw scanline byData into pPtr, PPU_Addr = wAddr, registers = dwData */
+#define PIPE_LINE 7
+/* A write in the middle of the scanline, byReg = byData, wDot = wAddr,
+   byIdx and wOld = dwData, pbyOld = pPtr */
+#define PIPE_LOG 8
+
+/* Registers of PIPE_LINE */
+#define PIPE_LINE_R0(a) ((a)&0xff)
+#define PIPE_LINE_R1(a) (((a) >> 8) & 0xff)
+#define PIPE_LINE_H_BYTE(a) (((a) >> 16) & 0x1f)
+#define PIPE_LINE_H_BIT(a) (((a) >> 21) & 0x7)
+#define PIPE_LINE_CLIP(a) (((a) >> 24) & 0x1)
+#define PIPE_LINE_SPR_CNT(a) ((a) >> 25)
+
+struct PipeCmd_tag
+{
+  BYTE byType;
+  BYTE byData;
+  WORD wAddr;
+  DWORD dwData;
+  void *pPtr;
+};
+
+/*-------------------------------------------------------------------*/
+/*  Pipeline resources                                               */
+/*-------------------------------------------------------------------*/
+
+/* Scanlines are passed to InfoNES_PipeRender() ( 0: InfoNES_DrawLine() ) */
+BYTE RenderPipe;
+
+/* Use the pipeline from the next InfoNES_Reset() */
+static BYTE PipeEnable;
+
+/* Times the pipeline was stopped by a write outside PPU RAM */
+DWORD PipeStopCnt;
+
+/* Start the pipeline again at the next V-Blank */
+static BYTE PipeResume;
+
+/* Ring */
+static struct PipeCmd_tag PipeRing[PIPE_RING_SIZE];
+static std::atomic<DWORD> PipeHead; /* Written by core 0 */
+static std::atomic<DWORD> PipeTail; /* Written by core 1 */
+
+/* PPUBANK entries as last logged ( core 0 ) */
+static BYTE *PipeBankSent[16];
+
+/* The copy drawn from ( core 1 ) */
+static BYTE PipePPURAM[PPURAM_SIZE];
+static WORD PipePalTable[32];
+static BYTE PipeSPRRAM[SPRRAM_SIZE];
+static BYTE *PipeBank[16];
+static BYTE PipeSprList[SPR_LINE_MAX];
+static struct InfoNES_PPULog_tag PipeLog[PPU_LOG_MAX];
+static int PipeLogCnt;
+
+/*-------------------------------------------------------------------*/
+/*  Ring                                                             */
+/*-------------------------------------------------------------------*/
+
+static inline void InfoNES_PipePush(BYTE byType, BYTE byData, WORD wAddr,
+                                    DWORD dwData, void *pPtr)
+{
+  DWORD dwHead = PipeHead.load(std::memory_order_relaxed);
+
+  // Wait for room
+  while (dwHead - PipeTail.load(std::memory_order_acquire) == PIPE_RING_SIZE)
+    InfoNES_PipeWait();
+
+  struct PipeCmd_tag *pCmd = &PipeRing[dwHead & (PIPE_RING_SIZE - 1)];
+  pCmd->byType = byType;
+  pCmd->byData = byData;
+  pCmd->wAddr = wAddr;
+  pCmd->dwData = dwData;
+  pCmd->pPtr = pPtr;
+
+  PipeHead.store(dwHead + 1, std::memory_order_release);
+}
+
+/* Offset of a byte in PPU RAM ( -1 : somewhere else ) */
+static inline int InfoNES_PipeOffset(const BYTE *pbyData)
+{
+  uintptr_t nOfs = (uintptr_t)pbyData - (uintptr_t)PPURAM;
+  return nOfs < PPURAM_SIZE ? (int)nOfs : -1;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*        InfoNES_PipeEnable() : Use the render pipeline             */
+/*                                                                   */
+/*===================================================================*/
+void InfoNES_PipeEnable(int nEnable)
+{
+  /*
+ *  Use the render pipeline from the next InfoNES_Reset()
+ *
+ *  Parameters
+ *    int nEnable                      (Read)
+ *      1 : InfoNES_PipeRender() is called on the other core
+ *      0 : Draw in place
+ */
+  PipeEnable = nEnable ? 1 : 0;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*        InfoNES_PipeStart() : Start the render pipeline            */
+/*                                                                   */
+/*===================================================================*/
+void InfoNES_PipeStart()
+{
+  /*
+ *  Start the render pipeline
+ *
+ *  Remarks
+ *    Called at the end of InfoNES_Reset(), after the mapper is set up,
+ *    and by InfoNES_PipeVBlank(). The ring is empty here, so core 1
+ *    doesn't touch the copy.
+ */
+  RenderPipe = 0;
+  PipeResume = 0;
+  if (!PipeEnable || (MapperHooks & (MAPPER_HOOK_PPU | MAPPER_HOOK_RENDER_SCREEN)))
+    return;
+
+  InfoNES_MemoryCopy(PipePPURAM, PPURAM, PPURAM_SIZE);
+  InfoNES_MemoryCopy(PipePalTable, PalTable, sizeof PipePalTable);
+  InfoNES_MemoryCopy(PipeSPRRAM, SPRRAM, SPRRAM_SIZE);
+  InfoNES_MemorySet(PipeBankSent, 0, sizeof PipeBankSent);
+  PipeLogCnt = 0;
+
+  // The cache is keyed by the pages of the copy from now on
+  InfoNES_ResetRender();
+
+  RenderPipe = 1;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*         InfoNES_PipeStop() : Stop the render pipeline             */
+/*                                                                   */
+/*===================================================================*/
+void InfoNES_PipeStop()
+{
+  /*
+ *  Stop the render pipeline
+ *
+ *  Remarks
+ *    Waits for the scanlines in the ring. The following scanlines are
+ *    drawn in place by InfoNES_DrawLine() until the next reset.
+ */
+  if (!RenderPipe)
+    return;
+
+  InfoNES_PipeSync();
+  RenderPipe = 0;
+
+  // The cache was keyed by the pages of the copy
+  InfoNES_ResetRender();
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*     InfoNES_PipeVBlank() : Restart the pipeline in V-Blank        */
+/*                                                                   */
+/*===================================================================*/
+void InfoNES_PipeVBlank()
+{
+  /*
+ *  Start the render pipeline again if a write outside PPU RAM stopped it
+ *
+ *  Remarks
+ *    Called at the start of V-Blank, where no scanline is drawn.
+ */
+  if (PipeResume)
+    InfoNES_PipeStart();
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*     InfoNES_PipeSync() : Wait until the ring is drawn             */
+/*                                                                   */
+/*===================================================================*/
+void InfoNES_PipeSync()
+{
+  /*
+ *  Wait until the scanlines in the ring are drawn
+ *
+ *  Remarks
+ *    Call this before reading the line buffers on core 0.
+ */
+  const DWORD dwHead = PipeHead.load(std::memory_order_relaxed);
+
+  while (PipeTail.load(std::memory_order_acquire) != dwHead)
+    InfoNES_PipeWait();
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*          InfoNES_PipeLine() : Log the current scanline            */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_PipeLine)(const BYTE *pbySprList, int nSprCnt,
+                                           const struct InfoNES_PPULog_tag *pLog, int nLogCnt)
+{
+  /*
+ *  Log the current scanline
+ *
+ *  Parameters
+ *    const BYTE *pbySprList           (Read)
+ *      Sprites on the scanline ( SPRRAM offsets )
+ *
+ *    int nSprCnt                      (Read)
+ *      The number of sprites on the scanline
+ *
+ *    const struct InfoNES_PPULog_tag *pLog  (Read)
+ *      The writes in the middle of the scanline
+ *
+ *    int nLogCnt                      (Read)
+ *      The number of the writes
+ *
+ *  Remarks
+ *    Called after InfoNES_PreDrawLine() in place of InfoNES_DrawLine().
+ *    Core 1 calls InfoNES_PostDrawLine() when it's drawn.
+ */
+  int nIdx;
+  int nBank;
+  DWORD dwRegs;
+
+  for (nBank = 0; nBank < 16; ++nBank)
+  {
+    if (PPUBANK[nBank] != PipeBankSent[nBank])
+    {
+      PipeBankSent[nBank] = PPUBANK[nBank];
+      InfoNES_PipePush(PIPE_BANK, nBank, 0, 0, PPUBANK[nBank]);
+    }
+  }
+
+  if (nSprCnt > SPR_LINE_MAX)
+    nSprCnt = SPR_LINE_MAX;
+  for (nIdx = 0; nIdx < nSprCnt; nIdx += 4)
+  {
+    DWORD dwList = 0;
+    for (int nByte = 0; nByte < 4 && nIdx + nByte < nSprCnt; ++nByte)
+      dwList |= (DWORD)pbySprList[nIdx + nByte] << (nByte * 8);
+    InfoNES_PipePush(PIPE_SPR, nIdx, 0, dwList, NULL);
+  }
+
+  for (nIdx = 0; nIdx < nLogCnt; ++nIdx)
+  {
+    InfoNES_PipePush(PIPE_LOG, pLog[nIdx].byReg, pLog[nIdx].wDot,
+                     pLog[nIdx].byIdx | ((DWORD)pLog[nIdx].wOld << 16), pLog[nIdx].pbyOld);
+  }
+
+  dwRegs = PPU_R0 | (PPU_R1 << 8) | (PPU_Scr_H_Byte << 16) | (PPU_Scr_H_Bit << 21) |
+           ((PPU_UpDown_Clip ? 1 : 0) << 24) | ((DWORD)nSprCnt << 25);
+  InfoNES_PipePush(PIPE_LINE, PPU_Scanline, PPU_Addr, dwRegs, WorkLine);
+}
+
+/* Draw in place until the next V-Blank ( 0: the pipeline was stopped ) */
+static int InfoNES_PipeHold()
+{
+  InfoNES_PipeStop();
+  PipeResume = 1;
+  ++PipeStopCnt;
+  return 0;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*   InfoNES_PipeVram() : Log a write to the pattern or name tables  */
+/*                                                                   */
+/*===================================================================*/
+int __not_in_flash_func(InfoNES_PipeVram)(WORD wAddr, BYTE byData)
+{
+  /*
+ *  Write to the pattern or name tables and log it
+ *
+ *  Parameters
+ *    WORD wAddr                       (Read)
+ *      PPU address ( 0x0000 - 0x3eff )
+ *
+ *    BYTE byData                      (Read)
+ *      Data
+ *
+ *  Return values
+ *    1 : Written and logged, or ignored by CHR-ROM
+ *    0 : Not written, the pipeline was stopped instead
+ *
+ *  Remarks
+ *    Only PPU RAM has a copy, so a write to a mapper's own memory stops
+ *    the pipeline before the memory is changed. InfoNES_PipeVBlank()
+ *    starts it again from a new copy.
+ */
+  BYTE *pbyDst = PPUBANK[wAddr >> 10] + (wAddr & 0x3ff);
+  const int nOfs = InfoNES_PipeOffset(pbyDst);
+
+  if (wAddr < 0x2000 && byVramWriteEnable)
+  {
+    // Pattern Data
+    if (nOfs < 0)
+      return InfoNES_PipeHold();
+    *pbyDst = byData;
+    InfoNES_PipePush(PIPE_CHR, byData, nOfs, 0, NULL);
+    return 1;
+  }
+
+  // Name Table and mirror
+  BYTE *pbyMirror = PPUBANK[(wAddr ^ 0x1000) >> 10] + (wAddr & 0x3ff);
+  const int nMirrorOfs = InfoNES_PipeOffset(pbyMirror);
+  if ((nOfs < 0 && !InfoNES_IsVRom(PPUBANK[wAddr >> 10])) ||
+      (nMirrorOfs < 0 && !InfoNES_IsVRom(PPUBANK[(wAddr ^ 0x1000) >> 10])))
+    return InfoNES_PipeHold();
+
+  // A write to pattern RAM lands here as well while VROM is mapped,
+  // CHR-ROM itself ignores the write
+  const BYTE byType = wAddr < 0x2000 ? PIPE_CHR : PIPE_VRAM;
+  if (nOfs >= 0)
+  {
+    *pbyDst = byData;
+    InfoNES_PipePush(byType, byData, nOfs, 0, NULL);
+  }
+  if (nMirrorOfs >= 0 && nMirrorOfs != nOfs)
+  {
+    *pbyMirror = byData;
+    InfoNES_PipePush(byType, byData, nMirrorOfs, 0, NULL);
+  }
+  return 1;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*        InfoNES_PipePal() : Log a written palette entry            */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_PipePal)(int nIdx)
+{
+  /*
+ *  Log a written palette entry
+ *
+ *  Parameters
+ *    int nIdx                         (Read)
+ *      Index of PalTable ( 0x00 and 0x10 : with the mirrors )
+ */
+  InfoNES_PipePush(PIPE_PAL, 0, nIdx, PalTable[nIdx], NULL);
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*        InfoNES_PipeOam() : Log a written byte of Sprite RAM       */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_PipeOam)(int nIdx)
+{
+  InfoNES_PipePush(PIPE_OAM, SPRRAM[nIdx], nIdx, 0, NULL);
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*     InfoNES_PipeOamDma() : Log the whole Sprite RAM after a DMA   */
+/*                                                                   */
+/*===================================================================*/
+void __not_in_flash_func(InfoNES_PipeOamDma)()
+{
+  int nIdx;
+
+  for (nIdx = 0; nIdx < SPRRAM_SIZE; nIdx += 4)
+  {
+    DWORD dwData = SPRRAM[nIdx] | (SPRRAM[nIdx + 1] << 8) |
+                   (SPRRAM[nIdx + 2] << 16) | ((DWORD)SPRRAM[nIdx + 3] << 24);
+    InfoNES_PipePush(PIPE_OAM4, 0, nIdx, dwData, NULL);
+  }
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*     InfoNES_PipeRender() : Draw the logged scanlines              */
+/*                                                                   */
+/*===================================================================*/
+int __not_in_flash_func(InfoNES_PipeRender)(int nMaxLines)
+{
+  /*
+ *  Draw the logged scanlines
+ *
+ *  Parameters
+ *    int nMaxLines                    (Read)
+ *      Scanlines to draw at most
+ *
+ *  Return values
+ *    The number of scanlines drawn
+ *
+ *  Remarks
+ *    Called on core 1 only. Returns at once when the ring is empty.
+ */
+  struct InfoNES_LineView_tag view;
+  DWORD dwTail = PipeTail.load(std::memory_order_relaxed);
+  const DWORD dwHead = PipeHead.load(std::memory_order_acquire);
+  int nLines = 0;
+  int nIdx;
+
+  while (dwTail != dwHead && nLines < nMaxLines)
+  {
+    const struct PipeCmd_tag *pCmd = &PipeRing[dwTail & (PIPE_RING_SIZE - 1)];
+
+    switch (pCmd->byType)
+    {
+    case PIPE_CHR:
+      PipePPURAM[pCmd->wAddr] = pCmd->byData;
+      InfoNES_ChrPageWrite(&PipePPURAM[pCmd->wAddr & ~0x3ff], pCmd->wAddr & 0x3ff);
+      break;
+
+    case PIPE_VRAM:
+      PipePPURAM[pCmd->wAddr] = pCmd->byData;
+      InfoNES_AttrWrite(&PipePPURAM[pCmd->wAddr & ~0x3ff], pCmd->wAddr & 0x3ff);
+      break;
+
+    case PIPE_PAL:
+      if (!(pCmd->wAddr & 0xf))
+      {
+        // Palette mirror
+        for (nIdx = 0; nIdx < 32; nIdx += 4)
+          PipePalTable[nIdx] = pCmd->dwData;
+        PalPairUpdate = 0xf;
+      }
+      else
+      {
+        PipePalTable[pCmd->wAddr] = pCmd->dwData;
+        if (!(pCmd->wAddr & 0x10))
+          PalPairUpdate |= 1 << (pCmd->wAddr >> 2);
+      }
+      break;
+
+    case PIPE_OAM:
+      PipeSPRRAM[pCmd->wAddr] = pCmd->byData;
+      break;
+
+    case PIPE_OAM4:
+      for (nIdx = 0; nIdx < 4; ++nIdx)
+        PipeSPRRAM[pCmd->wAddr + nIdx] = pCmd->dwData >> (nIdx * 8);
+      break;
+
+    case PIPE_SPR:
+      for (nIdx = 0; nIdx < 4 && pCmd->byData + nIdx < SPR_LINE_MAX; ++nIdx)
+        PipeSprList[pCmd->byData + nIdx] = pCmd->dwData >> (nIdx * 8);
+      break;
+
+    case PIPE_BANK:
+    {
+      // Pages of PPU RAM are drawn from the copy
+      BYTE *pbyBank = (BYTE *)pCmd->pPtr;
+      const int nOfs = InfoNES_PipeOffset(pbyBank);
+      PipeBank[pCmd->byData] = nOfs < 0 ? pbyBank : &PipePPURAM[nOfs];
+    }
+    break;
+
+    case PIPE_LOG:
+    {
+      struct InfoNES_PPULog_tag *pEntry = &PipeLog[PipeLogCnt++];
+      pEntry->wDot = pCmd->wAddr;
+      pEntry->byReg = pCmd->byData;
+      pEntry->byIdx = pCmd->dwData & 0xff;
+      pEntry->wOld = pCmd->dwData >> 16;
+
+      // Pages of PPU RAM are drawn from the copy
+      BYTE *pbyBank = (BYTE *)pCmd->pPtr;
+      const int nOfs = InfoNES_PipeOffset(pbyBank);
+      pEntry->pbyOld = nOfs < 0 ? pbyBank : &PipePPURAM[nOfs];
+    }
+    break;
+
+    case PIPE_LINE:
+      view.pwLine = (WORD *)pCmd->pPtr;
+      view.ppbyBank = PipeBank;
+      view.pwPalTable = PipePalTable;
+      view.pbySprRam = PipeSPRRAM;
+      view.pbySprList = PipeSprList;
+      view.nSprCnt = PIPE_LINE_SPR_CNT(pCmd->dwData);
+      view.wScanline = pCmd->byData;
+      view.wAddr = pCmd->wAddr;
+      view.byR0 = PIPE_LINE_R0(pCmd->dwData);
+      view.byR1 = PIPE_LINE_R1(pCmd->dwData);
+      view.byScrHByte = PIPE_LINE_H_BYTE(pCmd->dwData);
+      view.byScrHBit = PIPE_LINE_H_BIT(pCmd->dwData);
+      view.byUpDownClip = PIPE_LINE_CLIP(pCmd->dwData);
+
+      if (PipeLogCnt)
+        InfoNES_RenderSplitLine(&view, PipeLog, PipeLogCnt);
+      else
+        InfoNES_RenderLine(&view);
+      PipeLogCnt = 0;
+      InfoNES_PostDrawLine(pCmd->byData);
+      ++nLines;
+      break;
+    }
+
+    PipeTail.store(++dwTail, std::memory_order_release);
+  }
+  return nLines;
+}
+
+#endif /* INFONES_RENDER_PIPE */
+
+/*
+ * End of InfoNES_Pipe.cpp
+ */
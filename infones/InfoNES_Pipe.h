@@ -0,0 +1,73 @@
+/*===================================================================*/
+/*                                                                   */
+/*  InfoNES_Pipe.h : Render pipeline ( scanlines drawn by core 1 )   */
+/*                                                                   */
+/*===================================================================*/
+
+#ifndef InfoNES_PIPE_H_INCLUDED
+#define InfoNES_PIPE_H_INCLUDED
+
+/*-------------------------------------------------------------------*/
+/*  Include files                                                    */
+/*-------------------------------------------------------------------*/
+
+#include "InfoNES_Types.h"
+
+#if INFONES_RENDER_PIPE
+
+/*-------------------------------------------------------------------*/
+/*  Pipeline resources                                               */
+/*-------------------------------------------------------------------*/
+
+/* Commands in the ring ( a power of 2 ) */
+#ifndef PIPE_RING_SIZE
+#define PIPE_RING_SIZE 1024
+#endif
+
+/* Scanlines are passed to InfoNES_PipeRender() ( 0: InfoNES_DrawLine() ) */
+extern BYTE RenderPipe;
+
+/* Times the pipeline was stopped by a write outside PPU RAM */
+extern DWORD PipeStopCnt;
+
+/*-------------------------------------------------------------------*/
+/*  Function prototypes                                              */
+/*-------------------------------------------------------------------*/
+
+/* Use the pipeline from the next InfoNES_Reset() */
+void InfoNES_PipeEnable(int nEnable);
+
+/* Start the pipeline if the mapper allows */
+void InfoNES_PipeStart();
+
+/* Wait for the scanlines in the ring and draw the rest in place */
+void InfoNES_PipeStop();
+
+/* Start the pipeline again if a write outside PPU RAM stopped it */
+void InfoNES_PipeVBlank();
+
+/* Wait until the scanlines in the ring are drawn */
+void InfoNES_PipeSync();
+
+/* Log the current scanline */
+void InfoNES_PipeLine(const BYTE *pbySprList, int nSprCnt,
+                      const struct InfoNES_PPULog_tag *pLog, int nLogCnt);
+
+/* Log a write to the pattern or name tables ( 0: stopped instead ) */
+int InfoNES_PipeVram(WORD wAddr, BYTE byData);
+
+/* Log a written palette entry */
+void InfoNES_PipePal(int nIdx);
+
+/* Log a written byte of Sprite RAM */
+void InfoNES_PipeOam(int nIdx);
+
+/* Log the whole Sprite RAM after a DMA */
+void InfoNES_PipeOamDma();
+
+/* Draw the logged scanlines ( on the other core ) */
+int InfoNES_PipeRender(int nMaxLines);
+
+#endif /* INFONES_RENDER_PIPE */
+
+#endif /* !InfoNES_PIPE_H_INCLUDED */
@@ -68,8 +68,8 @@ int InfoNES_SoundOpen(int samples_per_sync, int sample_rate);
 /* Sound Close */
 void InfoNES_SoundClose(void);
 
-/* Sound Output 5 Waves - 2 Pulse, 1 Triangle, 1 Noise, 1 DPCM */
-void InfoNES_SoundOutput(int samples, BYTE *wave1, BYTE *wave2, BYTE *wave3, BYTE *wave4, BYTE *wave5);
+/* Sound Output - the mixed left and right samples, interleaved */
+void InfoNES_SoundOutput(int samples, const short *lr);
 int InfoNES_GetSoundBufferSize();
 
 /* Print system message */
@@ -78,4 +78,9 @@ void InfoNES_MessageBox(const char *pszMsg, ...);
 void InfoNES_PreDrawLine(int line);
 void InfoNES_PostDrawLine(int line);
 
+#if INFONES_RENDER_PIPE || INFONES_APU_PIPE
+/* Wait a moment for the other core ( see InfoNES_Pipe.cpp, InfoNES_pAPU.cpp ) */
+void InfoNES_PipeWait();
+#endif
+
 #endif /* !InfoNES_SYSTEM_H_INCLUDED */
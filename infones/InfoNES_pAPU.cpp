@@ -14,6 +14,10 @@
 #include "InfoNES_System.h"
 #include "InfoNES_pAPU.h"
 #include <algorithm>
+#include <stdint.h>
+#if INFONES_APU_PIPE
+#include <atomic>
+#endif
 #include <string.h>
 
 /*-------------------------------------------------------------------*/
@@ -94,8 +98,6 @@ ApuWritefunc pAPUSoundRegs[20] =
 /*   APU resources                                                   */
 /*-------------------------------------------------------------------*/
 
-BYTE wave_buffers[5][735]; /* 44100 / 60 = 735 samples per sync */
-
 BYTE ApuCtrl;
 BYTE ApuCtrlNew;
 
@@ -138,6 +140,12 @@ struct ApuQualityData_t
 // cycle_rate
 // 1789773 / 44100 * 65536 = 2659740.665034014
 
+// Pulse periods below 2 would divide by zero ( ultrasonic, so silence them )
+static inline DWORD ApuPulseSkip(DWORD freq)
+{
+  return freq >= 2 ? ApuPulseMagic / (freq / 2) : 0;
+}
+
 /*-------------------------------------------------------------------*/
 /*  Rectangle Wave #1 resources                                      */
 /*-------------------------------------------------------------------*/
@@ -208,18 +216,126 @@ int ApuC5Phaseacc;
 WORD ApuC5Address, ApuC5CacheAddr;
 int ApuC5DmaLength, ApuC5CacheDmaLength;
 
+/*-------------------------------------------------------------------*/
+/*  Batch resources                                                  */
+/*-------------------------------------------------------------------*/
+
+/* Wave parameters of a scanline ( after its register writes ) */
+struct ApuLine_t
+{
+  BYTE *pbyC1Wave;
+  BYTE *pbyC2Wave;
+  DWORD dwC1Skip;
+  DWORD dwC2Skip;
+  DWORD dwC3Skip;
+  DWORD dwC4Skip;
+  BYTE bySamples;
+  BYTE byOn; /* Bit 0 - 4 : Channel #1 - #5 sounds */
+  BYTE byC1Vol;
+  BYTE byC2Vol;
+  BYTE byC4Vol;
+  BYTE byC4Shift;
+  BYTE byC5Value[APU_LINE_SAMPLES]; /* DPCM output after each sample */
+};
+
+/* Scanlines synthesized at once */
+struct ApuBatch_t
+{
+  struct ApuLine_t Lines[APU_BATCH_LINES];
+  int nLines;
+  int nSamples;
+};
+
+#if INFONES_APU_PIPE
+#define APU_BATCHES APU_RING_BATCHES
+#else
+#define APU_BATCHES 1
+#endif
+
+struct ApuBatch_t ApuBatches[APU_BATCHES];
+
+/* The batch filled by InfoNES_pAPUHsync() */
+struct ApuBatch_t *ApuBatch = ApuBatches;
+
+#if INFONES_APU_PIPE
+/*-------------------------------------------------------------------*/
+/*  Pipeline resources                                               */
+/*-------------------------------------------------------------------*/
+
+/*
+ *  Core 0 runs the register writes, the length counters, the envelopes,
+ *  the sweeps and the DMC ( it reads the CPU memory and answers $4015 ),
+ *  so only the latched scanlines go to the other core.
+ *  ApuBatches is a single-producer / single-consumer ring of them, and
+ *  core 1 synthesizes and mixes them and outputs the samples.
+ *  The mixer resources belong to core 1 while the pipeline runs.
+ */
+
+/* Batches are passed to InfoNES_pAPURender() ( 0: synthesized in place ) */
+BYTE ApuPipe;
+
+/* Use the pipeline from the next InfoNES_pAPUInit() */
+static BYTE ApuPipeEnable;
+
+/* Batches in the ring ( the one being filled is not ) */
+static std::atomic<DWORD> ApuHead; /* Written by core 0 */
+static std::atomic<DWORD> ApuTail; /* Written by core 1 */
+#endif
+
+/*-------------------------------------------------------------------*/
+/*  Mixer resources                                                  */
+/*-------------------------------------------------------------------*/
+
+/*
+ *  The NES mixes the rectangles and the others nonlinearly, as groups:
+ *    pulse_out = 95.52 / (8128 / (pulse1 + pulse2) + 100)
+ *    tnd_out = 163.67 / (24329 / (3 * triangle + 2 * noise + dmc) + 100)
+ *  A table per group holds the left and right samples of each sum.
+ */
+#define APU_PULSE_LEVELS 31
+#define APU_TND_LEVELS 203
+
+/* Weights of the channels in the sum of the group ( DPCM is 6 bits ) */
+const BYTE ApuMixWeight[5] = {1, 1, 3, 2, 2};
+
+/* Samples of the group sums ( left and right, the pan folded in ) */
+short ApuPulseMix[APU_PULSE_LEVELS][2];
+short ApuTndMix[APU_TND_LEVELS][2];
+
+/* Pan preset ( see pAPU_PAN ) */
+int ApuPan;
+
+/* Gains of the groups at a full output ( 1.0 ) of the NES */
+struct ApuPanData_t
+{
+  short pulse_l;
+  short pulse_r;
+  short tnd_l;
+  short tnd_r;
+} ApuPanData[] = {
+    {16384, 16384, 16384, 16384}, /* Mono */
+    {18842, 13926, 13926, 18842}, /* Stereo */
+    {22938, 9830, 9830, 22938},   /* Wide */
+};
+
+/* Output level of each channel at each sample of the batch */
+BYTE ApuWave[5][APU_BATCH_SAMPLES];
+
+/* Mixed samples of the batch ( left and right interleaved ) */
+short ApuOut[APU_BATCH_SAMPLES * 2];
+
 /*-------------------------------------------------------------------*/
 /*  Wave Data                                                        */
 /*-------------------------------------------------------------------*/
 BYTE __not_in_flash_func(pulse_25)[0x20] = {
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
     0x00,
     0x00,
     0x00,
@@ -247,22 +363,22 @@ BYTE __not_in_flash_func(pulse_25)[0x20] = {
 };
 
 BYTE __not_in_flash_func(pulse_50)[0x20] = {
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
     0x00,
     0x00,
     0x00,
@@ -282,30 +398,30 @@ BYTE __not_in_flash_func(pulse_50)[0x20] = {
 };
 
 BYTE __not_in_flash_func(pulse_75)[0x20] = {
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
     0x00,
     0x00,
     0x00,
@@ -317,34 +433,34 @@ BYTE __not_in_flash_func(pulse_75)[0x20] = {
 };
 
 BYTE __not_in_flash_func(pulse_87)[0x20] = {
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
     0x00,
     0x00,
     0x00,
@@ -353,37 +469,37 @@ BYTE __not_in_flash_func(pulse_87)[0x20] = {
 
 BYTE __not_in_flash_func(triangle_50)[0x20] = {
     0x00,
-    0x10,
-    0x20,
-    0x30,
-    0x40,
-    0x50,
-    0x60,
-    0x70,
-    0x80,
-    0x90,
-    0xa0,
-    0xb0,
-    0xc0,
-    0xd0,
-    0xe0,
-    0xf0,
-    0xff,
-    0xef,
-    0xdf,
-    0xcf,
-    0xbf,
-    0xaf,
-    0x9f,
-    0x8f,
-    0x7f,
-    0x6f,
-    0x5f,
-    0x4f,
-    0x3f,
-    0x2f,
-    0x1f,
+    0x01,
+    0x02,
+    0x03,
+    0x04,
+    0x05,
+    0x06,
+    0x07,
+    0x08,
+    0x09,
+    0x0a,
+    0x0b,
+    0x0c,
+    0x0d,
+    0x0e,
     0x0f,
+    0x0f,
+    0x0e,
+    0x0d,
+    0x0c,
+    0x0b,
+    0x0a,
+    0x09,
+    0x08,
+    0x07,
+    0x06,
+    0x05,
+    0x04,
+    0x03,
+    0x02,
+    0x01,
+    0x00,
 };
 
 BYTE *__not_in_flash_func(pulse_waves)[4] = {
@@ -455,6 +571,25 @@ DWORD __not_in_flash_func(ApuDpcmCycles)[16] =
         428, 380, 340, 320, 286, 254, 226, 214,
         190, 160, 142, 128, 106, 85, 72, 54};
 
+/*-------------------------------------------------------------------*/
+/* Render a wave table channel over n samples                        */
+/*-------------------------------------------------------------------*/
+
+static void __not_in_flash_func(ApuRenderTable)(int nCh, DWORD *pdwIndex,
+                                                const BYTE *pbyWave, int nVol,
+                                                DWORD dwSkip, int nBase, int n)
+{
+  BYTE *pbyBuf = &ApuWave[nCh][nBase];
+  DWORD dwIndex = *pdwIndex;
+
+  for (int i = 0; i < n; i++)
+  {
+    dwIndex = (dwIndex + dwSkip) & 0x1fffffff;
+    pbyBuf[i] = pbyWave[dwIndex >> 24] * nVol;
+  }
+  *pdwIndex = dwIndex;
+}
+
 /*===================================================================*/
 /*                                                                   */
 /*      ApuRenderingWave1() : Rendering Rectangular Wave #1          */
@@ -490,7 +625,7 @@ int __not_in_flash_func(ApuWriteWave1)(int cycles, int event)
 
         if (ApuC1Freq)
         {
-          ApuC1Skip = ApuPulseMagic / (ApuC1Freq / 2);
+          ApuC1Skip = ApuPulseSkip(ApuC1Freq);
         }
         else
         {
@@ -505,7 +640,7 @@ int __not_in_flash_func(ApuWriteWave1)(int cycles, int event)
 
         if (ApuC1Freq)
         {
-          ApuC1Skip = ApuPulseMagic / (ApuC1Freq / 2);
+          ApuC1Skip = ApuPulseSkip(ApuC1Freq);
         }
         else
         {
@@ -531,29 +666,42 @@ int __not_in_flash_func(ApuWriteWave1)(int cycles, int event)
 }
 
 /*-------------------------------------------------------------------*/
-/* Rendering rectangular wave #1                                     */
+/* Latch rectangular wave #1 of a scanline                           */
 /*-------------------------------------------------------------------*/
 
-void __not_in_flash_func(ApuRenderingWave1)(int n)
+static inline void ApuLatchWave1(struct ApuLine_t *pLine)
 {
-  ApuCtrlNew = ApuCtrl;
-  ApuWriteWave1(ApuCyclesPerSample * (n + 1), 0);
-
   if ((ApuCtrlNew & 0x01) && (ApuC1Atl || ApuC1Hold) &&
       !(ApuC1Freq < 8 || (!ApuC1SweepIncDec && ApuC1Freq > ApuC1FreqLimit)))
   {
-    auto vol = ApuC1Env ? ApuC1Vol : ApuC1EnvVol;
-    for (unsigned int i = 0; i < n; i++)
+    pLine->byOn |= 0x01;
+    pLine->pbyC1Wave = ApuC1Wave;
+    pLine->dwC1Skip = ApuC1Skip;
+    pLine->byC1Vol = ApuC1Env ? ApuC1Vol : ApuC1EnvVol;
+  }
+}
+
+/*-------------------------------------------------------------------*/
+/* Rendering rectangular wave #1                                     */
+/*-------------------------------------------------------------------*/
+
+void __not_in_flash_func(ApuRenderingWave1)(const struct ApuLine_t *pLine, int nLines)
+{
+  for (int nBase = 0; nLines > 0; --nLines, ++pLine)
+  {
+    const int n = pLine->bySamples;
+
+    if (pLine->byOn & 0x01)
     {
       /* Wave Rendering */
-      ApuC1Index += ApuC1Skip;
-      ApuC1Index &= 0x1fffffff;
-      wave_buffers[0][i] = ApuC1Wave[ApuC1Index >> 24] * vol;
+      ApuRenderTable(0, &ApuC1Index, pLine->pbyC1Wave, pLine->byC1Vol,
+                     pLine->dwC1Skip, nBase, n);
     }
-  }
-  else
-  {
-    memset(wave_buffers[0], 0, 2 * n);
+    else
+    {
+      memset(&ApuWave[0][nBase], 0, n);
+    }
+    nBase += n;
   }
 }
 
@@ -592,7 +740,7 @@ int __not_in_flash_func(ApuWriteWave2)(int cycles, int event)
 
         if (ApuC2Freq)
         {
-          ApuC2Skip = ApuPulseMagic / (ApuC2Freq / 2);
+          ApuC2Skip = ApuPulseSkip(ApuC2Freq);
         }
         else
         {
@@ -607,7 +755,7 @@ int __not_in_flash_func(ApuWriteWave2)(int cycles, int event)
 
         if (ApuC2Freq)
         {
-          ApuC2Skip = ApuPulseMagic / (ApuC2Freq / 2);
+          ApuC2Skip = ApuPulseSkip(ApuC2Freq);
         }
         else
         {
@@ -632,29 +780,42 @@ int __not_in_flash_func(ApuWriteWave2)(int cycles, int event)
 }
 
 /*-------------------------------------------------------------------*/
-/* Rendering rectangular wave #2                                     */
+/* Latch rectangular wave #2 of a scanline                           */
 /*-------------------------------------------------------------------*/
 
-void __not_in_flash_func(ApuRenderingWave2)(int n)
+static inline void ApuLatchWave2(struct ApuLine_t *pLine)
 {
-  ApuCtrlNew = ApuCtrl;
-  ApuWriteWave2(ApuCyclesPerSample * (n + 1), 0);
-
   if ((ApuCtrlNew & 0x02) && (ApuC2Atl || ApuC2Hold) &&
       !(ApuC2Freq < 8 || (!ApuC2SweepIncDec && ApuC2Freq > ApuC2FreqLimit)))
   {
-    auto vol = ApuC2Env ? ApuC2Vol : ApuC2EnvVol;
-    for (unsigned int i = 0; i < n; i++)
+    pLine->byOn |= 0x02;
+    pLine->pbyC2Wave = ApuC2Wave;
+    pLine->dwC2Skip = ApuC2Skip;
+    pLine->byC2Vol = ApuC2Env ? ApuC2Vol : ApuC2EnvVol;
+  }
+}
+
+/*-------------------------------------------------------------------*/
+/* Rendering rectangular wave #2                                     */
+/*-------------------------------------------------------------------*/
+
+void __not_in_flash_func(ApuRenderingWave2)(const struct ApuLine_t *pLine, int nLines)
+{
+  for (int nBase = 0; nLines > 0; --nLines, ++pLine)
+  {
+    const int n = pLine->bySamples;
+
+    if (pLine->byOn & 0x02)
     {
       /* Wave Rendering */
-      ApuC2Index += ApuC2Skip;
-      ApuC2Index &= 0x1fffffff;
-      wave_buffers[1][i] = ApuC2Wave[ApuC2Index >> 24] * vol;
+      ApuRenderTable(1, &ApuC2Index, pLine->pbyC2Wave, pLine->byC2Vol,
+                     pLine->dwC2Skip, nBase, n);
     }
-  }
-  else
-  {
-    memset(wave_buffers[1], 0, 2 * n);
+    else
+    {
+      memset(&ApuWave[1][nBase], 0, n);
+    }
+    nBase += n;
   }
 }
 
@@ -727,27 +888,39 @@ int __not_in_flash_func(ApuWriteWave3)(int cycles, int event)
 }
 
 /*-------------------------------------------------------------------*/
-/* Rendering triangle wave #3                                        */
+/* Latch triangle wave #3 of a scanline                              */
 /*-------------------------------------------------------------------*/
 
-void __not_in_flash_func(ApuRenderingWave3)(int n)
+static inline void ApuLatchWave3(struct ApuLine_t *pLine)
 {
-  ApuCtrlNew = ApuCtrl;
-  ApuWriteWave3(ApuCyclesPerSample * (n + 1), 0);
-
   if ((ApuCtrlNew & 0x04) && ApuC3Atl > 0 && ApuC3Llc > 0 && ApuC3Freq >= 8)
   {
-    for (unsigned int i = 0; i < n; i++)
+    pLine->byOn |= 0x04;
+    pLine->dwC3Skip = ApuC3Skip;
+  }
+}
+
+/*-------------------------------------------------------------------*/
+/* Rendering triangle wave #3                                        */
+/*-------------------------------------------------------------------*/
+
+void __not_in_flash_func(ApuRenderingWave3)(const struct ApuLine_t *pLine, int nLines)
+{
+  for (int nBase = 0; nLines > 0; --nLines, ++pLine)
+  {
+    const int n = pLine->bySamples;
+
+    if (pLine->byOn & 0x04)
     {
       /* Wave Rendering */
-      ApuC3Index += ApuC3Skip;
-      ApuC3Index &= 0x1fffffff;
-      wave_buffers[2][i] = triangle_50[ApuC3Index >> 24];
+      ApuRenderTable(2, &ApuC3Index, triangle_50, 1,
+                     pLine->dwC3Skip, nBase, n);
     }
-  }
-  else
-  {
-    memset(wave_buffers[2], 0, 2 * n);
+    else
+    {
+      memset(&ApuWave[2][nBase], 0, n);
+    }
+    nBase += n;
   }
 }
 
@@ -833,49 +1006,56 @@ int __not_in_flash_func(ApuWriteWave4)(int cycles, int event)
 }
 
 /*-------------------------------------------------------------------*/
-/* Rendering noise channel #4                                        */
+/* Latch noise channel #4 of a scanline                              */
 /*-------------------------------------------------------------------*/
 
-void __not_in_flash_func(ApuRenderingWave4)(int n)
+static inline void ApuLatchWave4(struct ApuLine_t *pLine)
 {
-  ApuCtrlNew = ApuCtrl;
-  ApuWriteWave4(ApuCyclesPerSample * (n + 1), 0);
-
   if ((ApuCtrlNew & 0x08) && ApuC4Atl)
   {
-    int shift = ApuC4Small ? 6 : 1;
-    for (unsigned int i = 0; i < n; i++)
-    {
-      /* Wave Rendering */
-      ApuC4Index += ApuC4Skip;
-      if (ApuC4Index > 0xffffff)
-      {
-        int f = (ApuC4Sr ^ (ApuC4Sr >> shift)) & 1;
-        ApuC4Sr = (ApuC4Sr >> 1) | (f << 14);
+    pLine->byOn |= 0x08;
+    pLine->dwC4Skip = ApuC4Skip;
+    pLine->byC4Vol = ApuC4Env ? ApuC4Vol : ApuC4EnvVol;
+    pLine->byC4Shift = ApuC4Small ? 6 : 1;
+  }
+}
 
-        ApuC4Index &= 0xffffff;
-      }
+/*-------------------------------------------------------------------*/
+/* Rendering noise channel #4                                        */
+/*-------------------------------------------------------------------*/
 
-      if (!(ApuC4Sr & 1))
+void __not_in_flash_func(ApuRenderingWave4)(const struct ApuLine_t *pLine, int nLines)
+{
+  for (int nBase = 0; nLines > 0; --nLines, ++pLine)
+  {
+    const int n = pLine->bySamples;
+
+    if (pLine->byOn & 0x08)
+    {
+      const DWORD dwSkip = pLine->dwC4Skip;
+      const int vol = pLine->byC4Vol;
+      const int shift = pLine->byC4Shift;
+      for (int i = 0; i < n; i++)
       {
-        if (ApuC4Env)
+        /* Wave Rendering */
+        ApuC4Index += dwSkip;
+        if (ApuC4Index > 0xffffff)
         {
-          wave_buffers[3][i] = ApuC4Vol;
-        }
-        else
-        {
-          wave_buffers[3][i] = ApuC4EnvVol;
+          int f = (ApuC4Sr ^ (ApuC4Sr >> shift)) & 1;
+          ApuC4Sr = (ApuC4Sr >> 1) | (f << 14);
+
+          ApuC4Index &= 0xffffff;
         }
-      }
-      else
-      {
-        wave_buffers[3][i] = 0;
+
+        // The shift register is clocked once a sample at most
+        ApuWave[3][nBase + i] = (ApuC4Sr & 1) ? 0 : vol;
       }
     }
-  }
-  else
-  {
-    memset(wave_buffers[3], 0, n << 1);
+    else
+    {
+      memset(&ApuWave[3][nBase], 0, n);
+    }
+    nBase += n;
   }
 }
 
@@ -940,17 +1120,16 @@ int __not_in_flash_func(ApuWriteWave5)(int cycles, int event)
 }
 
 /*-------------------------------------------------------------------*/
-/* Rendering DPCM channel #5                                         */
+/* Run the DMC over a scanline and latch its output                  */
 /*-------------------------------------------------------------------*/
 
-void __not_in_flash_func(ApuRenderingWave5)(int n)
+static void __not_in_flash_func(ApuLatchWave5)(struct ApuLine_t *pLine)
 {
-  ApuCtrlNew = ApuCtrl;
-  ApuWriteWave5(ApuCyclesPerSample * (n + 1), 0);
-
   if (ApuCtrlNew & 0x10)
   {
-    for (unsigned int i = 0; i < n; i++)
+    pLine->byOn |= 0x10;
+    const int n = std::min<int>(pLine->bySamples, APU_LINE_SAMPLES);
+    for (int i = 0; i < n; i++)
     {
       if (ApuC5DmaLength)
       {
@@ -996,16 +1175,36 @@ void __not_in_flash_func(ApuRenderingWave5)(int n)
         }
       }
 
-      /* Wave Rendering */
-      wave_buffers[4][i] = ApuC5DpcmValue;
+      pLine->byC5Value[i] = ApuC5DpcmValue;
     }
   }
-  else
+}
+
+/*-------------------------------------------------------------------*/
+/* Rendering DPCM wave #5                                            */
+/*-------------------------------------------------------------------*/
+
+void __not_in_flash_func(ApuRenderingWave5)(const struct ApuLine_t *pLine, int nLines)
+{
+  for (int nBase = 0; nLines > 0; --nLines, ++pLine)
   {
-    memset(wave_buffers[4], 0, n << 1);
+    const int n = pLine->bySamples;
+
+    if (pLine->byOn & 0x10)
+    {
+      /* Wave Rendering */
+      for (int i = 0; i < n; i++)
+        ApuWave[4][nBase + i] = pLine->byC5Value[i];
+    }
+    else
+    {
+      memset(&ApuWave[4][nBase], 0, n);
+    }
+    nBase += n;
   }
 }
 
+
 /*===================================================================*/
 /*                                                                   */
 /*     InfoNES_pApuVsync() : Callback Function per Vsync             */
@@ -1014,6 +1213,9 @@ void __not_in_flash_func(ApuRenderingWave5)(int n)
 
 void InfoNES_pAPUVsync()
 {
+  /* A frame ends a batch */
+  InfoNES_pAPUFlush();
+
   if (ApuC1Atl)
   {
     ApuC1Atl--;
@@ -1054,7 +1256,7 @@ void InfoNES_pAPUVsync()
         ApuC1Freq += (ApuC1Freq >> ApuC1SweepShifts);
       }
 
-      ApuC1Skip = ApuPulseMagic / (ApuC1Freq / 2);
+      ApuC1Skip = ApuPulseSkip(ApuC1Freq);
     }
   }
 
@@ -1098,7 +1300,7 @@ void InfoNES_pAPUVsync()
         /* ramp down */
         ApuC2Freq += (ApuC2Freq >> ApuC2SweepShifts);
       }
-      ApuC2Skip = ApuPulseMagic / (ApuC2Freq / 2);
+      ApuC2Skip = ApuPulseSkip(ApuC2Freq);
     }
   }
 
@@ -1165,35 +1367,161 @@ void __not_in_flash_func(InfoNES_pAPUHsync)(bool enabled)
   auto n = n16 >> 16;
   leftSamples16 = n16 - (n << 16);
 
-  int bufferLeft = InfoNES_GetSoundBufferSize();
-  n = std::min<int>(bufferLeft, n);
+  struct ApuLine_t *pLine = &ApuBatch->Lines[ApuBatch->nLines++];
+  pLine->bySamples = n;
+  pLine->byOn = 0;
+  ApuBatch->nSamples += n;
 
   if (enabled)
   {
-    ApuRenderingWave1(n);
-    ApuRenderingWave2(n);
-    ApuRenderingWave3(n);
-    ApuRenderingWave4(n);
-    ApuRenderingWave5(n);
+    /* The register writes of this scanline come before its samples */
+    int cycles = ApuCyclesPerSample * (n + 1);
+    ApuCtrlNew = ApuCtrl;
+    if (cur_event)
+    {
+      ApuWriteWave1(cycles, 0);
+      ApuWriteWave2(cycles, 0);
+      ApuWriteWave3(cycles, 0);
+      ApuWriteWave4(cycles, 0);
+      ApuWriteWave5(cycles, 0);
+    }
+
+    /* The channels are rendered from the latches a batch at once */
+    ApuLatchWave1(pLine);
+    ApuLatchWave2(pLine);
+    ApuLatchWave3(pLine);
+    ApuLatchWave4(pLine);
+
+    // DPCM reads through the CPU page table of this scanline
+    K6502_SyncBanks();
+    ApuLatchWave5(pLine);
     ApuCtrl = ApuCtrlNew;
   }
-  else
+
+  entertime = getPassedClocks();
+  cur_event = 0;
+
+  if (ApuBatch->nLines == APU_BATCH_LINES)
+    InfoNES_pAPUFlush();
+}
+
+/*-------------------------------------------------------------------*/
+/* Synthesize a batch into ApuOut and get the samples                */
+/*-------------------------------------------------------------------*/
+
+static int __not_in_flash_func(ApuSynthesize)(const struct ApuBatch_t *pBatch)
+{
+  ApuRenderingWave5(pBatch->Lines, pBatch->nLines);
+  ApuRenderingWave1(pBatch->Lines, pBatch->nLines);
+  ApuRenderingWave2(pBatch->Lines, pBatch->nLines);
+  ApuRenderingWave3(pBatch->Lines, pBatch->nLines);
+  ApuRenderingWave4(pBatch->Lines, pBatch->nLines);
+
+  const int nSamples = pBatch->nSamples;
+  /* Mix the levels of each sample */
+  for (int i = 0; i < nSamples; ++i)
+  {
+    const short *pPulse = ApuPulseMix[ApuWave[0][i] * ApuMixWeight[0] +
+                                      ApuWave[1][i] * ApuMixWeight[1]];
+    const short *pTnd = ApuTndMix[ApuWave[2][i] * ApuMixWeight[2] +
+                                  ApuWave[3][i] * ApuMixWeight[3] +
+                                  ApuWave[4][i] * ApuMixWeight[4]];
+    ApuOut[i * 2] = pPulse[0] + pTnd[0];
+    ApuOut[i * 2 + 1] = pPulse[1] + pTnd[1];
+  }
+
+  return nSamples;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*     InfoNES_pApuFlush() : Output the batched scanlines            */
+/*                                                                   */
+/*===================================================================*/
+
+void __not_in_flash_func(InfoNES_pAPUFlush)()
+{
+  if (!ApuBatch->nLines)
+    return;
+
+#if INFONES_APU_PIPE
+  if (ApuPipe)
   {
-    memset(&wave_buffers[0][0], 0, n);
-    memset(&wave_buffers[1][0], 0, n);
-    memset(&wave_buffers[2][0], 0, n);
-    memset(&wave_buffers[3][0], 0, n);
-    memset(&wave_buffers[4][0], 0, n);
+    DWORD dwHead = ApuHead.load(std::memory_order_relaxed) + 1;
+    ApuHead.store(dwHead, std::memory_order_release);
+
+    // Wait for room to fill the next batch
+    while (dwHead - ApuTail.load(std::memory_order_acquire) == APU_RING_BATCHES)
+      InfoNES_PipeWait();
+
+    ApuBatch = &ApuBatches[dwHead & (APU_RING_BATCHES - 1)];
+    ApuBatch->nLines = 0;
+    ApuBatch->nSamples = 0;
+    return;
   }
+#endif
 
-  InfoNES_SoundOutput(n,
-                      wave_buffers[0], wave_buffers[1], wave_buffers[2],
-                      wave_buffers[3], wave_buffers[4]);
+  const int nSamples = ApuSynthesize(ApuBatch);
 
-  entertime = getPassedClocks();
-  cur_event = 0;
+  int bufferLeft = InfoNES_GetSoundBufferSize();
+  int n = std::min<int>(bufferLeft, nSamples);
+
+  InfoNES_SoundOutput(n, ApuOut);
+
+  ApuBatch->nLines = 0;
+  ApuBatch->nSamples = 0;
+}
+
+#if INFONES_APU_PIPE
+/*===================================================================*/
+/*                                                                   */
+/*   InfoNES_pAPUPipeEnable() : Use the pipeline from the next init  */
+/*                                                                   */
+/*===================================================================*/
+
+void InfoNES_pAPUPipeEnable(int nEnable)
+{
+  ApuPipeEnable = nEnable ? 1 : 0;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*     InfoNES_pAPUSync() : Wait for the batches in the ring         */
+/*                                                                   */
+/*===================================================================*/
+
+void InfoNES_pAPUSync()
+{
+  while (ApuTail.load(std::memory_order_acquire) != ApuHead.load(std::memory_order_relaxed))
+    InfoNES_PipeWait();
 }
 
+/*===================================================================*/
+/*                                                                   */
+/*  InfoNES_pAPURender() : Synthesize the batches ( the other core ) */
+/*                                                                   */
+/*===================================================================*/
+
+int __not_in_flash_func(InfoNES_pAPURender)(int nMaxBatches)
+{
+  /*
+   *  The platform makes sure there is room for nMaxBatches batches
+   *  in its sound buffer, InfoNES_GetSoundBufferSize() is of core 0.
+   */
+  DWORD dwTail = ApuTail.load(std::memory_order_relaxed);
+  int nBatches = 0;
+  while (nBatches < nMaxBatches && dwTail != ApuHead.load(std::memory_order_acquire))
+  {
+    const int nSamples = ApuSynthesize(&ApuBatches[dwTail & (APU_RING_BATCHES - 1)]);
+    InfoNES_SoundOutput(nSamples, ApuOut);
+
+    ApuTail.store(++dwTail, std::memory_order_release);
+    ++nBatches;
+  }
+  return nBatches;
+}
+#endif /* INFONES_APU_PIPE */
+
 /*===================================================================*/
 /*                                                                   */
 /*            InfoNES_pApuInit() : Initialize pApu                   */
@@ -1202,6 +1530,12 @@ void __not_in_flash_func(InfoNES_pAPUHsync)(bool enabled)
 
 void InfoNES_pAPUInit(void)
 {
+#if INFONES_APU_PIPE
+  /* Take the mixer back from the other core */
+  InfoNES_pAPUSync();
+  ApuPipe = ApuPipeEnable;
+#endif
+
   /* Sound Hardware Init */
   InfoNES_SoundInit();
 
@@ -1215,6 +1549,29 @@ void InfoNES_pAPUInit(void)
   ApuSampleRate = ApuQual[ApuQuality].sample_rate;
   ApuCycleRate = ApuQual[ApuQuality].cycle_rate;
 
+  /*-------------------------------------------------------------------*/
+  /*   Build the mixer tables of the pan preset                        */
+  /*-------------------------------------------------------------------*/
+  ApuPan = pAPU_PAN;
+
+  const struct ApuPanData_t *pPan = &ApuPanData[ApuPan];
+  for (int n = 0; n < APU_PULSE_LEVELS; ++n)
+  {
+    // 95.52 / (8128 / n + 100) = 9552 * n / (812800 + 10000 * n)
+    const int64_t nOut = 9552 * n;
+    const int nDiv = 812800 + 10000 * n;
+    ApuPulseMix[n][0] = (short)(nOut * pPan->pulse_l / nDiv);
+    ApuPulseMix[n][1] = (short)(nOut * pPan->pulse_r / nDiv);
+  }
+  for (int n = 0; n < APU_TND_LEVELS; ++n)
+  {
+    // 163.67 / (24329 / n + 100) = 16367 * n / (2432900 + 10000 * n)
+    const int64_t nOut = 16367 * n;
+    const int nDiv = 2432900 + 10000 * n;
+    ApuTndMix[n][0] = (short)(nOut * pPan->tnd_l / nDiv);
+    ApuTndMix[n][1] = (short)(nOut * pPan->tnd_r / nDiv);
+  }
+
   InfoNES_SoundOpen((ApuSamplesPerSync16 + 65535) >> 16, ApuSampleRate);
 
   /*-------------------------------------------------------------------*/
@@ -1259,11 +1616,8 @@ void InfoNES_pAPUInit(void)
   /*-------------------------------------------------------------------*/
   /*   Initialize Wave Buffers                                         */
   /*-------------------------------------------------------------------*/
-  InfoNES_MemorySet((void *)wave_buffers[0], 0, 735);
-  InfoNES_MemorySet((void *)wave_buffers[1], 0, 735);
-  InfoNES_MemorySet((void *)wave_buffers[2], 0, 735);
-  InfoNES_MemorySet((void *)wave_buffers[3], 0, 735);
-  InfoNES_MemorySet((void *)wave_buffers[4], 0, 735);
+  ApuBatch->nLines = 0;
+  ApuBatch->nSamples = 0;
 
   entertime = getPassedClocks();
   cur_event = 0;
@@ -1277,6 +1631,9 @@ void InfoNES_pAPUInit(void)
 
 void InfoNES_pAPUDone(void)
 {
+#if INFONES_APU_PIPE
+  InfoNES_pAPUSync();
+#endif
   InfoNES_SoundClose();
 }
 
@@ -155,6 +155,45 @@ void InfoNES_pAPUInit(void);
 void InfoNES_pAPUDone(void);
 void InfoNES_pAPUVsync(void);
 void InfoNES_pAPUHsync(bool enabled);
+void InfoNES_pAPUFlush(void);
+
+/*-------------------------------------------------------------------*/
+/*  pAPU Batch resources                                             */
+/*-------------------------------------------------------------------*/
+
+/* Scanlines synthesized at once ( bounded by the audio ring latency ) */
+#ifndef APU_BATCH_LINES
+#define APU_BATCH_LINES 16
+#endif
+
+/* Samples of a scanline at most ( 2.82 on average ) */
+#define APU_LINE_SAMPLES 3
+
+/* Samples of APU_BATCH_LINES scanlines at most */
+#define APU_BATCH_SAMPLES (APU_BATCH_LINES * APU_LINE_SAMPLES)
+
+#if INFONES_APU_PIPE
+/*-------------------------------------------------------------------*/
+/*  pAPU Pipeline resources ( batches synthesized by core 1 )        */
+/*-------------------------------------------------------------------*/
+
+/* Batches in the ring ( a power of 2 ) */
+#ifndef APU_RING_BATCHES
+#define APU_RING_BATCHES 4
+#endif
+
+/* Batches are passed to InfoNES_pAPURender() ( 0: synthesized in place ) */
+extern BYTE ApuPipe;
+
+/* Use the pipeline from the next InfoNES_pAPUInit() */
+void InfoNES_pAPUPipeEnable(int nEnable);
+
+/* Wait until the batches in the ring are synthesized */
+void InfoNES_pAPUSync(void);
+
+/* Synthesize the batches in the ring and output them ( on the other core ) */
+int InfoNES_pAPURender(int nMaxBatches);
+#endif /* INFONES_APU_PIPE */
 
 /*-------------------------------------------------------------------*/
 /*  pAPU Quality resources                                           */
@@ -170,6 +209,17 @@ void InfoNES_pAPUHsync(bool enabled);
 extern int ApuQuality;
 #define pAPU_QUALITY 3
 
+/*-------------------------------------------------------------------*/
+/* ApuPan places the channel groups in the stereo outputs.           */
+/* 0 is mono.                                                        */
+/* 1 puts the rectangles left and the others right.                  */
+/* 2 is the same, but wider.                                         */
+/*-------------------------------------------------------------------*/
+extern int ApuPan;
+#ifndef pAPU_PAN
+#define pAPU_PAN 1
+#endif
+
 /*-------------------------------------------------------------------*/
 /*  Rectangle Wave #1 resources                                      */
 /*-------------------------------------------------------------------*/
@@ -14,6 +14,7 @@
 #include "InfoNES_System.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <pico.h>
 
 /*-------------------------------------------------------------------*/
@@ -21,24 +22,32 @@
 /*-------------------------------------------------------------------*/
 
 // Clock Op.
-#define CLK(a) g_wPassedClocks += (a);
+#define CLK(a) nClocks += (a);
+
+// Fetch Op.
+// While PC is in RAM, SRAM or a ROM bank, the instruction bytes are read
+// through pbyPC up to pbyPCEnd. At the end K6502_Refill() moves to the next
+// bank, or reads a single byte into a buffer anywhere else.
+#define PC_NOW ((WORD)(wFetchBase + (pbyPC - pbyFetchBase)))
+#define SKIP(a) pbyPC += (a);
+#define JMP(a)           \
+  pbyPC = K6502_Jump(a); \
+  pbyPCEnd = pbyFetchEnd;
 
 // Addressing Op.
 // Address
 // (Indirect,X)
-#define AA_IX K6502_ReadZpW(K6502_Read(PC++) + X)
+#define AA_IX K6502_ReadZpW(wOperand + X)
 // (Indirect),Y
-#define AA_IY K6502_ReadZpW(K6502_Read(PC++)) + Y
+#define AA_IY K6502_ReadZpW(wOperand) + Y
 // Zero Page
-#define AA_ZP K6502_Read(PC++)
+#define AA_ZP wOperand
 // Zero Page,X
-#define AA_ZPX (BYTE)(K6502_Read(PC++) + X)
+#define AA_ZPX (BYTE)(wOperand + X)
 // Zero Page,Y
-#define AA_ZPY (BYTE)(K6502_Read(PC++) + Y)
+#define AA_ZPY (BYTE)(wOperand + Y)
 // Absolute
-#define AA_ABS (K6502_Read(PC++) | (WORD)K6502_Read(PC++) << 8)
-// Absolute2 ( PC-- )
-#define AA_ABS2 (K6502_Read(PC++) | (WORD)K6502_Read(PC) << 8)
+#define AA_ABS wOperand
 // Absolute,X
 #define AA_ABSX AA_ABS + X
 // Absolute,Y
@@ -48,7 +57,7 @@
 // (Indirect,X)
 #define A_IX K6502_Read(AA_IX)
 // (Indirect),Y
-#define A_IY K6502_ReadIY()
+#define A_IY K6502_Read(K6502_Index(K6502_ReadZpW(wOperand), Y, nClocks))
 // Zero Page
 #define A_ZP K6502_ReadZp(AA_ZP)
 // Zero Page,X
@@ -58,23 +67,51 @@
 // Absolute
 #define A_ABS K6502_Read(AA_ABS)
 // Absolute,X
-#define A_ABSX K6502_ReadAbsX()
+#define A_ABSX K6502_Read(K6502_Index(AA_ABS, X, nClocks))
 // Absolute,Y
-#define A_ABSY K6502_ReadAbsY()
+#define A_ABSY K6502_Read(K6502_Index(AA_ABS, Y, nClocks))
 // Immediate
-#define A_IMM K6502_Read(PC++)
+#define A_IMM (BYTE)wOperand
 
 // Flag Op.
+// N and Z are evaluated lazily from nNZ, the last result:
+//   Z : the lower 8 bits are 0
+//   N : bit 7 or bit 8 is set ( bit 8 makes N and Z both set, for BIT )
+// They are merged into F only when F itself is needed.
 #define SETF(a) F |= (a)
 #define RSTF(a) F &= ~(a)
-#define TEST(a)          \
-  RSTF(FLAG_N | FLAG_Z); \
-  SETF(g_byTestTable[a])
+#define TEST(a) nNZ = (a)
+#define FLAG_NZ(nz) ((((nz)&0xff) ? 0 : FLAG_Z) | (((nz)&0x180) ? FLAG_N : 0))
+#define GETF ((F & ~(FLAG_N | FLAG_Z)) | FLAG_NZ(nNZ))
+#define PUTF(a)                                                     \
+  F = (a);                                                          \
+  nNZ = ((F & FLAG_Z) ? 0 : 1) | ((F & FLAG_N) ? 0x100 : 0);
+#define IS_N (nNZ & 0x180)
+#define IS_Z (!(nNZ & 0xff))
+#define SET_C(a) F = (F & ~FLAG_C) | (a)
+
+// Store Op.
+// A write that misses the page table may switch the banks ( mapper ),
+// so K6502_WriteIO() sets the fetch window again. It may also set an
+// earlier deadline ( K6502_SetDeadline ), which ends the step there.
+#define WRITE(a, d)                              \
+  wA1 = (a);                                     \
+  if (K6502_WritePage[wA1 >> 8])                 \
+  {                                              \
+    K6502_WritePage[wA1 >> 8][wA1 & 0xff] = (d); \
+  }                                              \
+  else                                           \
+  {                                              \
+    g_wPassedClocks = nClocks;                   \
+    pbyPC = K6502_WriteIO(wA1, (d), pbyPC);      \
+    pbyPCEnd = pbyFetchEnd;                      \
+    wClocks = nStepEnd;                          \
+  }
 
 // Load & Store Op.
-#define STA(a) K6502_Write((a), A);
-#define STX(a) K6502_Write((a), X);
-#define STY(a) K6502_Write((a), Y);
+#define STA(a) WRITE((a), A);
+#define STX(a) WRITE((a), X);
+#define STY(a) WRITE((a), Y);
 #define LDA(a) \
   A = (a);     \
   TEST(A);
@@ -105,118 +142,276 @@
 #define EOR(a) \
   A ^= (a);    \
   TEST(A)
-#define BIT(a)                    \
-  byD0 = (a);                     \
-  RSTF(FLAG_N | FLAG_V | FLAG_Z); \
-  SETF((byD0 & (FLAG_N | FLAG_V)) | ((byD0 & A) ? 0 : FLAG_Z));
-#define CMP(a)                    \
-  wD0 = (WORD)A - (a);            \
-  RSTF(FLAG_N | FLAG_Z | FLAG_C); \
-  SETF(g_byTestTable[wD0 & 0xff] | (wD0 < 0x100 ? FLAG_C : 0));
-#define CPX(a)                    \
-  wD0 = (WORD)X - (a);            \
-  RSTF(FLAG_N | FLAG_Z | FLAG_C); \
-  SETF(g_byTestTable[wD0 & 0xff] | (wD0 < 0x100 ? FLAG_C : 0));
-#define CPY(a)                    \
-  wD0 = (WORD)Y - (a);            \
-  RSTF(FLAG_N | FLAG_Z | FLAG_C); \
-  SETF(g_byTestTable[wD0 & 0xff] | (wD0 < 0x100 ? FLAG_C : 0));
+#define BIT(a)                   \
+  byD0 = (a);                    \
+  RSTF(FLAG_V);                  \
+  SETF(byD0 & FLAG_V);           \
+  TEST((byD0 & A) | ((byD0 & FLAG_N) << 1));
+#define CMP(a)            \
+  wD0 = (WORD)A - (a);    \
+  TEST(wD0 & 0xff);       \
+  SET_C(wD0 < 0x100);
+#define CPX(a)            \
+  wD0 = (WORD)X - (a);    \
+  TEST(wD0 & 0xff);       \
+  SET_C(wD0 < 0x100);
+#define CPY(a)            \
+  wD0 = (WORD)Y - (a);    \
+  TEST(wD0 & 0xff);       \
+  SET_C(wD0 < 0x100);
 
 // Math Op. (A D flag isn't being supported.)
-#define ADC(a)                                                                                 \
-  byD0 = (a);                                                                                  \
-  wD0 = A + byD0 + (F & FLAG_C);                                                               \
-  byD1 = (BYTE)wD0;                                                                            \
-  RSTF(FLAG_N | FLAG_V | FLAG_Z | FLAG_C);                                                     \
-  SETF(g_byTestTable[byD1] | ((~(A ^ byD0) & (A ^ byD1) & 0x80) ? FLAG_V : 0) | (wD0 > 0xff)); \
-  A = byD1;
-
-#define SBC(a)                                                                                 \
-  byD0 = (a);                                                                                  \
-  wD0 = A - byD0 - (~F & FLAG_C);                                                              \
-  byD1 = (BYTE)wD0;                                                                            \
-  RSTF(FLAG_N | FLAG_V | FLAG_Z | FLAG_C);                                                     \
-  SETF(g_byTestTable[byD1] | (((A ^ byD0) & (A ^ byD1) & 0x80) ? FLAG_V : 0) | (wD0 < 0x100)); \
-  A = byD1;
+#define ADC(a)                                                          \
+  byD0 = (a);                                                           \
+  wD0 = A + byD0 + (F & FLAG_C);                                        \
+  byD1 = (BYTE)wD0;                                                     \
+  RSTF(FLAG_V | FLAG_C);                                                \
+  SETF(((~(A ^ byD0) & (A ^ byD1) & 0x80) ? FLAG_V : 0) | (wD0 > 0xff)); \
+  A = byD1;                                                             \
+  TEST(A);
+
+#define SBC(a)                                                         \
+  byD0 = (a);                                                          \
+  wD0 = A - byD0 - (~F & FLAG_C);                                      \
+  byD1 = (BYTE)wD0;                                                    \
+  RSTF(FLAG_V | FLAG_C);                                               \
+  SETF((((A ^ byD0) & (A ^ byD1) & 0x80) ? FLAG_V : 0) | (wD0 < 0x100)); \
+  A = byD1;                                                            \
+  TEST(A);
 
 #define DEC(a)            \
   wA0 = a;                \
   byD0 = K6502_Read(wA0); \
   --byD0;                 \
-  K6502_Write(wA0, byD0); \
+  WRITE(wA0, byD0);       \
   TEST(byD0)
 #define INC(a)            \
   wA0 = a;                \
   byD0 = K6502_Read(wA0); \
   ++byD0;                 \
-  K6502_Write(wA0, byD0); \
+  WRITE(wA0, byD0);       \
   TEST(byD0)
 
 // Shift Op.
-#define ASLA                      \
-  RSTF(FLAG_N | FLAG_Z | FLAG_C); \
-  SETF(g_ASLTable[A].byFlag);     \
-  A = g_ASLTable[A].byValue
-#define ASL(a)                    \
-  RSTF(FLAG_N | FLAG_Z | FLAG_C); \
-  wA0 = a;                        \
-  byD0 = K6502_Read(wA0);         \
-  SETF(g_ASLTable[byD0].byFlag);  \
-  K6502_Write(wA0, g_ASLTable[byD0].byValue)
-#define LSRA                      \
-  RSTF(FLAG_N | FLAG_Z | FLAG_C); \
-  SETF(g_LSRTable[A].byFlag);     \
-  A = g_LSRTable[A].byValue
-#define LSR(a)                    \
-  RSTF(FLAG_N | FLAG_Z | FLAG_C); \
-  wA0 = a;                        \
-  byD0 = K6502_Read(wA0);         \
-  SETF(g_LSRTable[byD0].byFlag);  \
-  K6502_Write(wA0, g_LSRTable[byD0].byValue)
-#define ROLA                        \
-  byD0 = F & FLAG_C;                \
-  RSTF(FLAG_N | FLAG_Z | FLAG_C);   \
-  SETF(g_ROLTable[byD0][A].byFlag); \
-  A = g_ROLTable[byD0][A].byValue
-#define ROL(a)                         \
-  byD1 = F & FLAG_C;                   \
-  RSTF(FLAG_N | FLAG_Z | FLAG_C);      \
-  wA0 = a;                             \
-  byD0 = K6502_Read(wA0);              \
-  SETF(g_ROLTable[byD1][byD0].byFlag); \
-  K6502_Write(wA0, g_ROLTable[byD1][byD0].byValue)
-#define RORA                        \
-  byD0 = F & FLAG_C;                \
-  RSTF(FLAG_N | FLAG_Z | FLAG_C);   \
-  SETF(g_RORTable[byD0][A].byFlag); \
-  A = g_RORTable[byD0][A].byValue
-#define ROR(a)                         \
-  byD1 = F & FLAG_C;                   \
-  RSTF(FLAG_N | FLAG_Z | FLAG_C);      \
-  wA0 = a;                             \
-  byD0 = K6502_Read(wA0);              \
-  SETF(g_RORTable[byD1][byD0].byFlag); \
-  K6502_Write(wA0, g_RORTable[byD1][byD0].byValue)
+#define ASLA          \
+  SET_C(A >> 7);      \
+  A <<= 1;            \
+  TEST(A)
+#define ASL(a)                \
+  wA0 = a;                    \
+  byD0 = K6502_Read(wA0);     \
+  SET_C(byD0 >> 7);           \
+  byD0 <<= 1;                 \
+  WRITE(wA0, byD0);           \
+  TEST(byD0)
+#define LSRA          \
+  SET_C(A & 1);       \
+  A >>= 1;            \
+  TEST(A)
+#define LSR(a)                \
+  wA0 = a;                    \
+  byD0 = K6502_Read(wA0);     \
+  SET_C(byD0 & 1);            \
+  byD0 >>= 1;                 \
+  WRITE(wA0, byD0);           \
+  TEST(byD0)
+#define ROLA                  \
+  byD0 = F & FLAG_C;          \
+  SET_C(A >> 7);              \
+  A = (A << 1) | byD0;        \
+  TEST(A)
+#define ROL(a)                \
+  byD1 = F & FLAG_C;          \
+  wA0 = a;                    \
+  byD0 = K6502_Read(wA0);     \
+  SET_C(byD0 >> 7);           \
+  byD0 = (byD0 << 1) | byD1;  \
+  WRITE(wA0, byD0);           \
+  TEST(byD0)
+#define RORA                  \
+  byD0 = F & FLAG_C;          \
+  SET_C(A & 1);               \
+  A = (A >> 1) | (byD0 << 7); \
+  TEST(A)
+#define ROR(a)                       \
+  byD1 = F & FLAG_C;                 \
+  wA0 = a;                           \
+  byD0 = K6502_Read(wA0);            \
+  SET_C(byD0 & 1);                   \
+  byD0 = (byD0 >> 1) | (byD1 << 7);  \
+  WRITE(wA0, byD0);                  \
+  TEST(byD0)
 
 // Jump Op.
-#define JSR      \
-  wA0 = AA_ABS2; \
-  PUSHW(PC);     \
-  PC = wA0;
-#define BRA(a)                                  \
-  if (a)                                        \
-  {                                             \
-    wA0 = PC;                                   \
-    PC += (int8_t)K6502_Read(PC);               \
-    CLK(3 + ((wA0 & 0x0100) != (PC & 0x0100))); \
-    ++PC;                                       \
-  }                                             \
-  else                                          \
-  {                                             \
-    ++PC;                                       \
-    CLK(2);                                     \
+// JSR pushes the address of its last byte.
+#define JSR         \
+  wA0 = AA_ABS;     \
+  wD0 = PC_NOW - 1; \
+  PUSHW(wD0);       \
+  JMP(wA0);
+// A branch inside the current bank only moves pbyPC.
+#define BRA(a)                                               \
+  if (a)                                                     \
+  {                                                          \
+    byD0 = (BYTE)wOperand;                                   \
+    wA0 = PC_NOW - 1;                                        \
+    wD0 = wA0 + (int8_t)byD0;                                \
+    CLK(3 + ((wA0 & 0x0100) != (wD0 & 0x0100)));             \
+    nD0 = (pbyPC - pbyFetchBase) + (int8_t)byD0;             \
+    if ((unsigned)nD0 < (unsigned)(pbyPCEnd - pbyFetchBase)) \
+    {                                                        \
+      if ((int8_t)byD0 < 0)                                  \
+      {                                                      \
+        IDLE_LOOP(pbyFetchBase + nD0, pbyPC - 2);            \
+      }                                                      \
+      pbyPC = pbyFetchBase + nD0;                            \
+    }                                                        \
+    else                                                     \
+    {                                                        \
+      JMP(wD0 + 1);                                          \
+    }                                                        \
+  }                                                          \
+  else                                                       \
+  {                                                          \
+    CLK(2);                                                  \
+  }
+
+// Idle Op.
+// A loop that repeats the same nLoop clocks until the end of the step
+// skips all of its iterations but the last one, which runs as usual.
+#define IDLE(nLoop)                                   \
+  if (wClocks - nClocks > (nLoop))                    \
+  {                                                   \
+    nD1 = (wClocks - nClocks - 1) / (nLoop) * (nLoop); \
+    CLK(nD1);                                         \
+    g_dwIdleClocks += nD1;                            \
   }
-#define JMP(a) PC = a;
+// A backward branch to pbyLoop is an idle loop if the loop only reads
+// RAM, ROM or the PPU status ( K6502_IsIdleLoop ), and the registers
+// are the same twice in a row. Nothing else changes these until the end
+// of the step, and the second read of the PPU status returns the same.
+#define IDLE_LOOP(pbyLoop, pbyBranch)                                 \
+  nD1 = A | X << 8 | Y << 16 | F << 24;                               \
+  if ((pbyLoop) == pbyIdleLoop && nD1 == nIdleRegs && nNZ == nIdleNZ) \
+  {                                                                   \
+    if (++nIdleHits >= 2 && K6502_IsIdleLoop((pbyLoop), (pbyBranch)))  \
+    {                                                                 \
+      IDLE(nClocks - nIdleClocks);                                    \
+    }                                                                 \
+  }                                                                   \
+  else                                                                \
+  {                                                                   \
+    pbyIdleLoop = (pbyLoop);                                          \
+    nIdleRegs = nD1;                                                  \
+    nIdleNZ = nNZ;                                                    \
+    nIdleHits = 0;                                                    \
+  }                                                                   \
+  nIdleClocks = nClocks;
+
+// Decode Op.
+// The opcode and the operand ( wOperand ) are read before dispatching.
+// Instructions in ROM are decoded once into K6502_DecodeCache, indexed and
+// tagged by the host address of the opcode. The bytes under a ROM pointer
+// never change, so bank switches need no invalidation.
+#define DECODE                                                                    \
+  pDecode = &K6502_DecodeCache[(uintptr_t)pbyPC & (K6502_DECODE_CACHE_SIZE - 1)]; \
+  if (pDecode->pbyOp == pbyPC && pbyPC < pbyPCEnd)                                \
+  {                                                                               \
+    byCode = pDecode->byCode;                                                     \
+    wOperand = pDecode->wOperand;                                                 \
+    pbyPC += pDecode->byLength;                                                   \
+  }                                                                               \
+  else if (wFetchBase < 0x8000 && pbyPCEnd - pbyPC >= 3)                          \
+  {                                                                               \
+    /* RAM and SRAM may be rewritten, so they are decoded every time */           \
+    byCode = pbyPC[0];                                                            \
+    nD0 = K6502_OperandBytes[byCode];                                             \
+    wOperand = (pbyPC[1] | pbyPC[2] << 8) & (0xffff >> (16 - 8 * nD0));           \
+    pbyPC += 1 + nD0;                                                             \
+  }                                                                               \
+  else                                                                            \
+  {                                                                               \
+    pDecode = K6502_Decode(pbyPC);                                                \
+    pbyPC = pDecode->pbyOp + pDecode->byLength;                                   \
+    pbyPCEnd = pbyFetchEnd;                                                       \
+    byCode = pDecode->byCode;                                                     \
+    wOperand = pDecode->wOperand;                                                 \
+  }
+
+// Dispatch Op.
+
+// Instruction fetch window ( wFetchBase is at pbyFetchBase )
+static const BYTE *pbyFetchBase;
+static const BYTE *pbyFetchEnd;
+static WORD wFetchBase;
+
+// Pre-decoded instruction ( 8 bytes on RP2040 )
+struct K6502_Decode_tag
+{
+  const BYTE *pbyOp;
+  BYTE byCode;
+  BYTE byLength;
+  WORD wOperand;
+};
+
+#ifndef K6502_DECODE_CACHE_SIZE
+#define K6502_DECODE_CACHE_SIZE 1024
+#endif
+
+// The number of the operand bytes read by each instruction
+// ( BRK, DOP and TOP skip theirs without reading them )
+static const BYTE K6502_OperandBytes[256] = {
+    0, 1, 0, 0, 0, 1, 1, 0, 0, 1, 0, 0, 0, 2, 2, 0, /* 0x00 */
+    1, 1, 0, 0, 0, 1, 1, 0, 0, 2, 0, 0, 0, 2, 2, 0, /* 0x10 */
+    2, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0, 0, 2, 2, 2, 0, /* 0x20 */
+    1, 1, 0, 0, 0, 1, 1, 0, 0, 2, 0, 0, 0, 2, 2, 0, /* 0x30 */
+    0, 1, 0, 0, 0, 1, 1, 0, 0, 1, 0, 0, 2, 2, 2, 0, /* 0x40 */
+    1, 1, 0, 0, 0, 1, 1, 0, 0, 2, 0, 0, 0, 2, 2, 0, /* 0x50 */
+    0, 1, 0, 0, 0, 1, 1, 0, 0, 1, 0, 0, 2, 2, 2, 0, /* 0x60 */
+    1, 1, 0, 0, 0, 1, 1, 0, 0, 2, 0, 0, 0, 2, 2, 0, /* 0x70 */
+    0, 1, 0, 0, 1, 1, 1, 0, 0, 0, 0, 0, 2, 2, 2, 0, /* 0x80 */
+    1, 1, 0, 0, 1, 1, 1, 0, 0, 2, 0, 0, 0, 2, 0, 0, /* 0x90 */
+    1, 1, 1, 0, 1, 1, 1, 0, 0, 1, 0, 0, 2, 2, 2, 0, /* 0xA0 */
+    1, 1, 0, 0, 1, 1, 1, 0, 0, 2, 0, 0, 2, 2, 2, 0, /* 0xB0 */
+    1, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0, 0, 2, 2, 2, 0, /* 0xC0 */
+    1, 1, 0, 0, 0, 1, 1, 0, 0, 2, 0, 0, 0, 2, 2, 0, /* 0xD0 */
+    1, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0, 0, 2, 2, 2, 0, /* 0xE0 */
+    1, 1, 0, 0, 0, 1, 1, 0, 0, 2, 0, 0, 0, 2, 2, 0, /* 0xF0 */
+};
+
+// Pre-decoded instructions in ROM
+static struct K6502_Decode_tag K6502_DecodeCache[K6502_DECODE_CACHE_SIZE];
+
+// Page table and fetch window ( defined after K6502_rw.h )
+extern BYTE *K6502_WritePage[256];
+static const BYTE *K6502_Jump(WORD wAddr);
+static const BYTE *K6502_Refill(const BYTE *pbyPC);
+static const BYTE *K6502_WriteIO(WORD wAddr, BYTE byData, const BYTE *pbyPC);
+static bool K6502_IsIdleLoop(const BYTE *pbyOp, const BYTE *pbyBranch);
+static const struct K6502_Decode_tag *K6502_Decode(const BYTE *pbyPC);
+
+#ifdef K6502_COUNT_INSTRUCTIONS
+#define COUNT_INSTRUCTION ++g_dwInstructions;
+#else
+#define COUNT_INSTRUCTION
+#endif
+
+#if K6502_THREADED_DISPATCH
+// Every handler fetches the next instruction and jumps through the label
+// table by itself (GCC computed goto).
+#define OP(a) L_##a:
+#define OP_DEFAULT L_default:
+#define NEXT                       \
+  if (nClocks >= wClocks)          \
+    goto end_of_step;              \
+  COUNT_INSTRUCTION                \
+  DECODE                           \
+  goto *opTable[byCode]
+#else
+#define OP(a) case a:
+#define OP_DEFAULT default:
+#define NEXT break
+#endif
 
 /*-------------------------------------------------------------------*/
 /*  Global valiables                                                 */
@@ -246,32 +441,49 @@ BYTE NMI_Wiring;
 int g_wPassedClocks;
 int g_wCurrentClocks;
 
+// The clock where g_wPassedClocks counts from ( see K6502_GetClocks )
+static DWORD dwStepBase;
+
+// The end of the current step ( lowered by K6502_SetDeadline )
+static int nStepEnd;
+
+#ifdef K6502_COUNT_INSTRUCTIONS
+// The number of the executed instructions
+DWORD g_dwInstructions;
+#endif
+
+// The number of the clocks skipped in idle loops
+DWORD g_dwIdleClocks;
+
 WORD getPassedClocks()
 {
   return g_wCurrentClocks;
 }
 
-// A table for the test
-BYTE g_byTestTable[256];
-
-// Value and Flag Data
-struct value_table_tag
+DWORD K6502_GetClocks()
 {
-  BYTE byValue;
-  BYTE byFlag;
-};
-
-// A table for ASL
-struct value_table_tag g_ASLTable[256];
-
-// A table for LSR
-struct value_table_tag g_LSRTable[256];
+  // In a step, g_wPassedClocks is updated at each I/O write
+  return dwStepBase + g_wPassedClocks;
+}
 
-// A table for ROL
-struct value_table_tag g_ROLTable[2][256];
+void K6502_SetDeadline(DWORD dwClock)
+{
+  int nEnd = (int)(dwClock - dwStepBase);
+  if (nEnd < nStepEnd)
+  {
+    nStepEnd = nEnd;
+  }
+}
 
-// A table for ROR
-struct value_table_tag g_RORTable[2][256];
+void K6502_GetRegs(struct K6502_Regs_tag *pRegs)
+{
+  pRegs->PC = PC;
+  pRegs->SP = SP;
+  pRegs->F = F;
+  pRegs->A = A;
+  pRegs->X = X;
+  pRegs->Y = Y;
+}
 
 /*===================================================================*/
 /*                                                                   */
@@ -286,104 +498,14 @@ void K6502_Init()
  *  You must call this function only once at first.
  */
 
-  BYTE idx;
-  BYTE idx2;
-
   // The establishment of the IRQ pin
   NMI_Wiring = NMI_State = 1;
   IRQ_Wiring = IRQ_State = 1;
-
-  // Make a table for the test
-  idx = 0;
-  do
-  {
-    if (idx == 0)
-      g_byTestTable[0] = FLAG_Z;
-    else if (idx > 127)
-      g_byTestTable[idx] = FLAG_N;
-    else
-      g_byTestTable[idx] = 0;
-
-    ++idx;
-  } while (idx != 0);
-
-  // Make a table ASL
-  idx = 0;
-  do
-  {
-    g_ASLTable[idx].byValue = idx << 1;
-    g_ASLTable[idx].byFlag = 0;
-
-    if (idx > 127)
-      g_ASLTable[idx].byFlag = FLAG_C;
-
-    if (g_ASLTable[idx].byValue == 0)
-      g_ASLTable[idx].byFlag |= FLAG_Z;
-    else if (g_ASLTable[idx].byValue & 0x80)
-      g_ASLTable[idx].byFlag |= FLAG_N;
-
-    ++idx;
-  } while (idx != 0);
-
-  // Make a table LSR
-  idx = 0;
-  do
-  {
-    g_LSRTable[idx].byValue = idx >> 1;
-    g_LSRTable[idx].byFlag = 0;
-
-    if (idx & 1)
-      g_LSRTable[idx].byFlag = FLAG_C;
-
-    if (g_LSRTable[idx].byValue == 0)
-      g_LSRTable[idx].byFlag |= FLAG_Z;
-
-    ++idx;
-  } while (idx != 0);
-
-  // Make a table ROL
-  for (idx2 = 0; idx2 < 2; ++idx2)
-  {
-    idx = 0;
-    do
-    {
-      g_ROLTable[idx2][idx].byValue = (idx << 1) | idx2;
-      g_ROLTable[idx2][idx].byFlag = 0;
-
-      if (idx > 127)
-        g_ROLTable[idx2][idx].byFlag = FLAG_C;
-
-      if (g_ROLTable[idx2][idx].byValue == 0)
-        g_ROLTable[idx2][idx].byFlag |= FLAG_Z;
-      else if (g_ROLTable[idx2][idx].byValue & 0x80)
-        g_ROLTable[idx2][idx].byFlag |= FLAG_N;
-
-      ++idx;
-    } while (idx != 0);
-  }
-
-  // Make a table ROR
-  for (idx2 = 0; idx2 < 2; ++idx2)
-  {
-    idx = 0;
-    do
-    {
-      g_RORTable[idx2][idx].byValue = (idx >> 1) | (idx2 << 7);
-      g_RORTable[idx2][idx].byFlag = 0;
-
-      if (idx & 1)
-        g_RORTable[idx2][idx].byFlag = FLAG_C;
-
-      if (g_RORTable[idx2][idx].byValue == 0)
-        g_RORTable[idx2][idx].byFlag |= FLAG_Z;
-      else if (g_RORTable[idx2][idx].byValue & 0x80)
-        g_RORTable[idx2][idx].byFlag |= FLAG_N;
-
-      ++idx;
-    } while (idx != 0);
-  }
 }
 
+// Map the memory into the page table
+static void K6502_ResetPages();
+
 /*===================================================================*/
 /*                                                                   */
 /*                K6502_Reset() : Reset a CPU                        */
@@ -396,6 +518,12 @@ void K6502_Reset()
  *
  */
 
+  // Map the memory
+  K6502_ResetPages();
+
+  // The ROM may have been replaced
+  memset(K6502_DecodeCache, 0, sizeof K6502_DecodeCache);
+
   // Reset Registers
   PC = K6502_ReadW(VECTOR_RESET);
   SP = 0xFF;
@@ -409,6 +537,7 @@ void K6502_Reset()
   // Reset Passed Clocks
   g_wPassedClocks = 0;
   g_wCurrentClocks = 0;
+  dwStepBase = 0;
 }
 
 /*===================================================================*/
@@ -427,6 +556,14 @@ void K6502_Set_Int_Wiring(BYTE byNMI_Wiring, BYTE byIRQ_Wiring)
   IRQ_Wiring = byIRQ_Wiring;
 }
 
+// Indexed address with the page crossing penalty
+static inline WORD K6502_Index(WORD wAddr, BYTE byIndex, int &nClocks)
+{
+  WORD wAddr2 = wAddr + byIndex;
+  nClocks += (wAddr & 0x0100) != (wAddr2 & 0x0100);
+  return wAddr2;
+}
+
 static void __not_in_flash_func(procNMI)()
 {
   // Dispose of it if there is an interrupt requirement
@@ -434,7 +571,7 @@ static void __not_in_flash_func(procNMI)()
   {
     // NMI Interrupt
     NMI_State = NMI_Wiring;
-    CLK(7);
+    g_wPassedClocks += 7;
 
     PUSHW(PC);
     PUSH(F & ~FLAG_B);
@@ -451,7 +588,7 @@ static void __not_in_flash_func(procNMI)()
     if (!(F & FLAG_I))
     {
       IRQ_State = IRQ_Wiring;
-      CLK(7);
+      g_wPassedClocks += 7;
 
       PUSHW(PC);
       PUSH(F & ~FLAG_B);
@@ -477,14 +614,86 @@ static void __not_in_flash_func(step)(int wClocks)
   BYTE byCode;
 
   WORD wA0;
+  WORD wA1;
   BYTE byD0;
   BYTE byD1;
+  WORD wOperand;
+  const struct K6502_Decode_tag *pDecode;
   WORD wD0;
-
-  auto prePassedClocks = g_wPassedClocks;
-
+  int nD0;
+  int nD1;
+
+  // The registers live in locals while executing, and are written back
+  // at the end. Nothing else reads them in the middle of a step: I/O
+  // handlers only raise IRQ/NMI, which are taken between steps, and
+  // getPassedClocks() is updated per step.
+  BYTE SP = ::SP;
+  BYTE F;
+  BYTE A = ::A;
+  BYTE X = ::X;
+  BYTE Y = ::Y;
+  int nClocks = g_wPassedClocks;
+  int nNZ;
+  PUTF(::F);
+
+  // Instruction fetch ( see PC_NOW )
+  const BYTE *pbyPC;
+  const BYTE *pbyPCEnd;
+  JMP(::PC);
+
+  // Idle loop candidate ( see IDLE_LOOP )
+  const BYTE *pbyIdleLoop = NULL;
+  int nIdleRegs = 0;
+  int nIdleNZ = 0;
+  int nIdleHits = 0;
+  int nIdleClocks = 0;
+
+  auto prePassedClocks = nClocks;
+  nStepEnd = wClocks;
+
+#if K6502_THREADED_DISPATCH
+  // Handlers by opcode ( unlisted ones go to the default handler )
+  static const void *const opTable[256] = {
+      &&L_0x00, &&L_0x01, &&L_default, &&L_default, &&L_0x04, &&L_0x05, &&L_0x06, &&L_default,
+      &&L_0x08, &&L_0x09, &&L_0x0A, &&L_default, &&L_0x0C, &&L_0x0D, &&L_0x0E, &&L_default,
+      &&L_0x10, &&L_0x11, &&L_default, &&L_default, &&L_0x14, &&L_0x15, &&L_0x16, &&L_default,
+      &&L_0x18, &&L_0x19, &&L_0x1A, &&L_default, &&L_0x1C, &&L_0x1D, &&L_0x1E, &&L_default,
+      &&L_0x20, &&L_0x21, &&L_default, &&L_default, &&L_0x24, &&L_0x25, &&L_0x26, &&L_default,
+      &&L_0x28, &&L_0x29, &&L_0x2A, &&L_default, &&L_0x2C, &&L_0x2D, &&L_0x2E, &&L_default,
+      &&L_0x30, &&L_0x31, &&L_default, &&L_default, &&L_0x34, &&L_0x35, &&L_0x36, &&L_default,
+      &&L_0x38, &&L_0x39, &&L_0x3A, &&L_default, &&L_0x3C, &&L_0x3D, &&L_0x3E, &&L_default,
+      &&L_0x40, &&L_0x41, &&L_default, &&L_default, &&L_0x44, &&L_0x45, &&L_0x46, &&L_default,
+      &&L_0x48, &&L_0x49, &&L_0x4A, &&L_default, &&L_0x4C, &&L_0x4D, &&L_0x4E, &&L_default,
+      &&L_0x50, &&L_0x51, &&L_default, &&L_default, &&L_0x54, &&L_0x55, &&L_0x56, &&L_default,
+      &&L_0x58, &&L_0x59, &&L_0x5A, &&L_default, &&L_0x5C, &&L_0x5D, &&L_0x5E, &&L_default,
+      &&L_0x60, &&L_0x61, &&L_default, &&L_default, &&L_0x64, &&L_0x65, &&L_0x66, &&L_default,
+      &&L_0x68, &&L_0x69, &&L_0x6A, &&L_default, &&L_0x6C, &&L_0x6D, &&L_0x6E, &&L_default,
+      &&L_0x70, &&L_0x71, &&L_default, &&L_default, &&L_0x74, &&L_0x75, &&L_0x76, &&L_default,
+      &&L_0x78, &&L_0x79, &&L_0x7A, &&L_default, &&L_0x7C, &&L_0x7D, &&L_0x7E, &&L_default,
+      &&L_0x80, &&L_0x81, &&L_0x82, &&L_default, &&L_0x84, &&L_0x85, &&L_0x86, &&L_default,
+      &&L_0x88, &&L_0x89, &&L_0x8A, &&L_default, &&L_0x8C, &&L_0x8D, &&L_0x8E, &&L_default,
+      &&L_0x90, &&L_0x91, &&L_default, &&L_default, &&L_0x94, &&L_0x95, &&L_0x96, &&L_default,
+      &&L_0x98, &&L_0x99, &&L_0x9A, &&L_default, &&L_default, &&L_0x9D, &&L_default, &&L_default,
+      &&L_0xA0, &&L_0xA1, &&L_0xA2, &&L_default, &&L_0xA4, &&L_0xA5, &&L_0xA6, &&L_default,
+      &&L_0xA8, &&L_0xA9, &&L_0xAA, &&L_default, &&L_0xAC, &&L_0xAD, &&L_0xAE, &&L_default,
+      &&L_0xB0, &&L_0xB1, &&L_default, &&L_default, &&L_0xB4, &&L_0xB5, &&L_0xB6, &&L_default,
+      &&L_0xB8, &&L_0xB9, &&L_0xBA, &&L_default, &&L_0xBC, &&L_0xBD, &&L_0xBE, &&L_default,
+      &&L_0xC0, &&L_0xC1, &&L_0xC2, &&L_default, &&L_0xC4, &&L_0xC5, &&L_0xC6, &&L_default,
+      &&L_0xC8, &&L_0xC9, &&L_0xCA, &&L_default, &&L_0xCC, &&L_0xCD, &&L_0xCE, &&L_default,
+      &&L_0xD0, &&L_0xD1, &&L_default, &&L_default, &&L_0xD4, &&L_0xD5, &&L_0xD6, &&L_default,
+      &&L_0xD8, &&L_0xD9, &&L_0xDA, &&L_default, &&L_0xDC, &&L_0xDD, &&L_0xDE, &&L_default,
+      &&L_0xE0, &&L_0xE1, &&L_0xE2, &&L_default, &&L_0xE4, &&L_0xE5, &&L_0xE6, &&L_default,
+      &&L_0xE8, &&L_0xE9, &&L_0xEA, &&L_default, &&L_0xEC, &&L_0xED, &&L_0xEE, &&L_default,
+      &&L_0xF0, &&L_0xF1, &&L_default, &&L_default, &&L_0xF4, &&L_0xF5, &&L_0xF6, &&L_default,
+      &&L_0xF8, &&L_0xF9, &&L_0xFA, &&L_default, &&L_0xFC, &&L_0xFD, &&L_0xFE, &&L_default,
+  };
+
+  // Read the first instruction
+  NEXT;
+  {
+#else
   // It has a loop until a constant clock passes
-  while (g_wPassedClocks < wClocks)
+  while (nClocks < wClocks)
   {
     // if (PC == 0xc449 || PC == 0xc955)
     // {
@@ -497,251 +706,252 @@ static void __not_in_flash_func(step)(int wClocks)
     // }
 
     // Read an instruction
-    byCode = K6502_Read(PC++);
+    COUNT_INSTRUCTION
+    DECODE
 
     //    printf("PC %04x %02x\n", PC - 1, byCode);
 
     // Execute an instruction.
     switch (byCode)
     {
-    case 0x00: // BRK
-      ++PC;
-      PUSHW(PC);
+#endif
+    OP(0x00) // BRK
+      SKIP(1);
+      wA0 = PC_NOW;
+      PUSHW(wA0);
       SETF(FLAG_B);
-      PUSH(F);
+      PUSH(GETF);
       SETF(FLAG_I);
       RSTF(FLAG_D);
-      PC = K6502_ReadW(VECTOR_IRQ);
+      JMP(K6502_ReadW(VECTOR_IRQ));
       CLK(7);
-      break;
+      NEXT;
 
-    case 0x01: // ORA (Zpg,X)
+    OP(0x01) // ORA (Zpg,X)
       ORA(A_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x05: // ORA Zpg
+    OP(0x05) // ORA Zpg
       ORA(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x06: // ASL Zpg
+    OP(0x06) // ASL Zpg
       ASL(AA_ZP);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x08: // PHP
+    OP(0x08) // PHP
       SETF(FLAG_B);
-      PUSH(F);
+      PUSH(GETF);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x09: // ORA #Oper
+    OP(0x09) // ORA #Oper
       ORA(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x0A: // ASL A
+    OP(0x0A) // ASL A
       ASLA;
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x0D: // ORA Abs
+    OP(0x0D) // ORA Abs
       ORA(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x0e: // ASL Abs
+    OP(0x0E) // ASL Abs
       ASL(AA_ABS);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x10: // BPL Oper
-      BRA(!(F & FLAG_N));
-      break;
+    OP(0x10) // BPL Oper
+      BRA(!IS_N);
+      NEXT;
 
-    case 0x11: // ORA (Zpg),Y
+    OP(0x11) // ORA (Zpg),Y
       ORA(A_IY);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x15: // ORA Zpg,X
+    OP(0x15) // ORA Zpg,X
       ORA(A_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x16: // ASL Zpg,X
+    OP(0x16) // ASL Zpg,X
       ASL(AA_ZPX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x18: // CLC
+    OP(0x18) // CLC
       RSTF(FLAG_C);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x19: // ORA Abs,Y
+    OP(0x19) // ORA Abs,Y
       ORA(A_ABSY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x1D: // ORA Abs,X
+    OP(0x1D) // ORA Abs,X
       ORA(A_ABSX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x1E: // ASL Abs,X
+    OP(0x1E) // ASL Abs,X
       ASL(AA_ABSX);
       CLK(7);
-      break;
+      NEXT;
 
-    case 0x20: // JSR Abs
+    OP(0x20) // JSR Abs
       JSR;
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x21: // AND (Zpg,X)
+    OP(0x21) // AND (Zpg,X)
       AND(A_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x24: // BIT Zpg
+    OP(0x24) // BIT Zpg
       BIT(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x25: // AND Zpg
+    OP(0x25) // AND Zpg
       AND(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x26: // ROL Zpg
+    OP(0x26) // ROL Zpg
       ROL(AA_ZP);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x28: // PLP
-      POP(F);
-      SETF(FLAG_R);
+    OP(0x28) // PLP
+      POP(byD0);
+      PUTF(byD0 | FLAG_R);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x29: // AND #Oper
+    OP(0x29) // AND #Oper
       AND(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x2A: // ROL A
+    OP(0x2A) // ROL A
       ROLA;
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x2C: // BIT Abs
+    OP(0x2C) // BIT Abs
       BIT(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x2D: // AND Abs
+    OP(0x2D) // AND Abs
       AND(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x2E: // ROL Abs
+    OP(0x2E) // ROL Abs
       ROL(AA_ABS);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x30: // BMI Oper
-      BRA(F & FLAG_N);
-      break;
+    OP(0x30) // BMI Oper
+      BRA(IS_N);
+      NEXT;
 
-    case 0x31: // AND (Zpg),Y
+    OP(0x31) // AND (Zpg),Y
       AND(A_IY);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x35: // AND Zpg,X
+    OP(0x35) // AND Zpg,X
       AND(A_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x36: // ROL Zpg,X
+    OP(0x36) // ROL Zpg,X
       ROL(AA_ZPX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x38: // SEC
+    OP(0x38) // SEC
       SETF(FLAG_C);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x39: // AND Abs,Y
+    OP(0x39) // AND Abs,Y
       AND(A_ABSY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x3D: // AND Abs,X
+    OP(0x3D) // AND Abs,X
       AND(A_ABSX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x3E: // ROL Abs,X
+    OP(0x3E) // ROL Abs,X
       ROL(AA_ABSX);
       CLK(7);
-      break;
+      NEXT;
 
-    case 0x40: // RTI
-      POP(F);
-      SETF(FLAG_R);
-      POPW(PC);
+    OP(0x40) // RTI
+      POP(byD0);
+      PUTF(byD0 | FLAG_R);
+      POPW(wA0);
+      JMP(wA0);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x41: // EOR (Zpg,X)
+    OP(0x41) // EOR (Zpg,X)
       EOR(A_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x45: // EOR Zpg
+    OP(0x45) // EOR Zpg
       EOR(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x46: // LSR Zpg
+    OP(0x46) // LSR Zpg
       LSR(AA_ZP);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x48: // PHA
+    OP(0x48) // PHA
       PUSH(A);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x49: // EOR #Oper
+    OP(0x49) // EOR #Oper
       EOR(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x4A: // LSR A
+    OP(0x4A) // LSR A
       LSRA;
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x4C: // JMP Abs
+    OP(0x4C) // JMP Abs
 #if 0
       JMP(AA_ABS);
       CLK(3);
 #else
     {
       auto addr = AA_ABS;
-      if (addr == PC - 3)
+      if (addr == PC_NOW - 3)
       {
         JMP(addr);
-        do
-        {
-          CLK(3);
-        } while (g_wPassedClocks < wClocks);
-        break;
+        CLK(3);
+        IDLE(3);
       }
       else
       {
@@ -750,38 +960,38 @@ static void __not_in_flash_func(step)(int wClocks)
       }
     }
 #endif
-      break;
+      NEXT;
 
-    case 0x4D: // EOR Abs
+    OP(0x4D) // EOR Abs
       EOR(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x4E: // LSR Abs
+    OP(0x4E) // LSR Abs
       LSR(AA_ABS);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x50: // BVC
+    OP(0x50) // BVC
       BRA(!(F & FLAG_V));
-      break;
+      NEXT;
 
-    case 0x51: // EOR (Zpg),Y
+    OP(0x51) // EOR (Zpg),Y
       EOR(A_IY);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x55: // EOR Zpg,X
+    OP(0x55) // EOR Zpg,X
       EOR(A_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x56: // LSR Zpg,X
+    OP(0x56) // LSR Zpg,X
       LSR(AA_ZPX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x58: // CLI
+    OP(0x58) // CLI
       byD0 = F;
       RSTF(FLAG_I);
       CLK(2);
@@ -790,638 +1000,967 @@ static void __not_in_flash_func(step)(int wClocks)
         IRQ_State = IRQ_Wiring;
         CLK(7);
 
-        PUSHW(PC);
-        PUSH(F & ~FLAG_B);
+        wA0 = PC_NOW;
+        PUSHW(wA0);
+        PUSH(GETF & ~FLAG_B);
 
         RSTF(FLAG_D);
         SETF(FLAG_I);
 
-        PC = K6502_ReadW(VECTOR_IRQ);
+        JMP(K6502_ReadW(VECTOR_IRQ));
       }
-      break;
+      NEXT;
 
-    case 0x59: // EOR Abs,Y
+    OP(0x59) // EOR Abs,Y
       EOR(A_ABSY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x5D: // EOR Abs,X
+    OP(0x5D) // EOR Abs,X
       EOR(A_ABSX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x5E: // LSR Abs,X
+    OP(0x5E) // LSR Abs,X
       LSR(AA_ABSX);
       CLK(7);
-      break;
+      NEXT;
 
-    case 0x60: // RTS
-      POPW(PC);
-      ++PC;
+    OP(0x60) // RTS
+      POPW(wA0);
+      JMP(wA0 + 1);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x61: // ADC (Zpg,X)
+    OP(0x61) // ADC (Zpg,X)
       ADC(A_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x65: // ADC Zpg
+    OP(0x65) // ADC Zpg
       ADC(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x66: // ROR Zpg
+    OP(0x66) // ROR Zpg
       ROR(AA_ZP);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x68: // PLA
+    OP(0x68) // PLA
       POP(A);
       TEST(A);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x69: // ADC #Oper
+    OP(0x69) // ADC #Oper
       ADC(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x6A: // ROR A
+    OP(0x6A) // ROR A
       RORA;
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x6C: // JMP (Abs)
+    OP(0x6C) // JMP (Abs)
       JMP(K6502_ReadW2(AA_ABS));
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x6D: // ADC Abs
+    OP(0x6D) // ADC Abs
       ADC(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x6E: // ROR Abs
+    OP(0x6E) // ROR Abs
       ROR(AA_ABS);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x70: // BVS
+    OP(0x70) // BVS
       BRA(F & FLAG_V);
-      break;
+      NEXT;
 
-    case 0x71: // ADC (Zpg),Y
+    OP(0x71) // ADC (Zpg),Y
       ADC(A_IY);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x75: // ADC Zpg,X
+    OP(0x75) // ADC Zpg,X
       ADC(A_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x76: // ROR Zpg,X
+    OP(0x76) // ROR Zpg,X
       ROR(AA_ZPX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x78: // SEI
+    OP(0x78) // SEI
       SETF(FLAG_I);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x79: // ADC Abs,Y
+    OP(0x79) // ADC Abs,Y
       ADC(A_ABSY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x7D: // ADC Abs,X
+    OP(0x7D) // ADC Abs,X
       ADC(A_ABSX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x7E: // ROR Abs,X
+    OP(0x7E) // ROR Abs,X
       ROR(AA_ABSX);
       CLK(7);
-      break;
+      NEXT;
 
-    case 0x81: // STA (Zpg,X)
+    OP(0x81) // STA (Zpg,X)
       STA(AA_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x84: // STY Zpg
+    OP(0x84) // STY Zpg
       STY(AA_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x85: // STA Zpg
+    OP(0x85) // STA Zpg
       STA(AA_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x86: // STX Zpg
+    OP(0x86) // STX Zpg
       STX(AA_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0x88: // DEY
+    OP(0x88) // DEY
       --Y;
       TEST(Y);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x8A: // TXA
+    OP(0x8A) // TXA
       A = X;
       TEST(A);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x8C: // STY Abs
+    OP(0x8C) // STY Abs
       STY(AA_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x8D: // STA Abs
+    OP(0x8D) // STA Abs
       STA(AA_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x8E: // STX Abs
+    OP(0x8E) // STX Abs
       STX(AA_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x90: // BCC
+    OP(0x90) // BCC
       BRA(!(F & FLAG_C));
-      break;
+      NEXT;
 
-    case 0x91: // STA (Zpg),Y
+    OP(0x91) // STA (Zpg),Y
       STA(AA_IY);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0x94: // STY Zpg,X
+    OP(0x94) // STY Zpg,X
       STY(AA_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x95: // STA Zpg,X
+    OP(0x95) // STA Zpg,X
       STA(AA_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x96: // STX Zpg,Y
+    OP(0x96) // STX Zpg,Y
       STX(AA_ZPY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0x98: // TYA
+    OP(0x98) // TYA
       A = Y;
       TEST(A);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x99: // STA Abs,Y
+    OP(0x99) // STA Abs,Y
       STA(AA_ABSY);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0x9A: // TXS
+    OP(0x9A) // TXS
       SP = X;
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x9D: // STA Abs,X
+    OP(0x9D) // STA Abs,X
       STA(AA_ABSX);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0xA0: // LDY #Oper
+    OP(0xA0) // LDY #Oper
       LDY(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xA1: // LDA (Zpg,X)
+    OP(0xA1) // LDA (Zpg,X)
       LDA(A_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0xA2: // LDX #Oper
+    OP(0xA2) // LDX #Oper
       LDX(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xA4: // LDY Zpg
+    OP(0xA4) // LDY Zpg
       LDY(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0xA5: // LDA Zpg
+    OP(0xA5) // LDA Zpg
       LDA(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0xA6: // LDX Zpg
+    OP(0xA6) // LDX Zpg
       LDX(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0xA8: // TAY
+    OP(0xA8) // TAY
       Y = A;
       TEST(A);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xA9: // LDA #Oper
+    OP(0xA9) // LDA #Oper
       LDA(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xAA: // TAX
+    OP(0xAA) // TAX
       X = A;
       TEST(A);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xAC: // LDY Abs
+    OP(0xAC) // LDY Abs
       LDY(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xAD: // LDA Abs
+    OP(0xAD) // LDA Abs
       LDA(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xAE: // LDX Abs
+    OP(0xAE) // LDX Abs
       LDX(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xB0: // BCS
+    OP(0xB0) // BCS
       BRA(F & FLAG_C);
-      break;
+      NEXT;
 
-    case 0xB1: // LDA (Zpg),Y
+    OP(0xB1) // LDA (Zpg),Y
       LDA(A_IY);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0xB4: // LDY Zpg,X
+    OP(0xB4) // LDY Zpg,X
       LDY(A_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xB5: // LDA Zpg,X
+    OP(0xB5) // LDA Zpg,X
       LDA(A_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xB6: // LDX Zpg,Y
+    OP(0xB6) // LDX Zpg,Y
       LDX(A_ZPY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xB8: // CLV
+    OP(0xB8) // CLV
       RSTF(FLAG_V);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xB9: // LDA Abs,Y
+    OP(0xB9) // LDA Abs,Y
       LDA(A_ABSY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xBA: // TSX
+    OP(0xBA) // TSX
       X = SP;
       TEST(X);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xBC: // LDY Abs,X
+    OP(0xBC) // LDY Abs,X
       LDY(A_ABSX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xBD: // LDA Abs,X
+    OP(0xBD) // LDA Abs,X
       LDA(A_ABSX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xBE: // LDX Abs,Y
+    OP(0xBE) // LDX Abs,Y
       LDX(A_ABSY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xC0: // CPY #Oper
+    OP(0xC0) // CPY #Oper
       CPY(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xC1: // CMP (Zpg,X)
+    OP(0xC1) // CMP (Zpg,X)
       CMP(A_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0xC4: // CPY Zpg
+    OP(0xC4) // CPY Zpg
       CPY(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0xC5: // CMP Zpg
+    OP(0xC5) // CMP Zpg
       CMP(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0xC6: // DEC Zpg
+    OP(0xC6) // DEC Zpg
       DEC(AA_ZP);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0xC8: // INY
+    OP(0xC8) // INY
       ++Y;
       TEST(Y);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xC9: // CMP #Oper
+    OP(0xC9) // CMP #Oper
       CMP(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xCA: // DEX
+    OP(0xCA) // DEX
       --X;
       TEST(X);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xCC: // CPY Abs
+    OP(0xCC) // CPY Abs
       CPY(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xCD: // CMP Abs
+    OP(0xCD) // CMP Abs
       CMP(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xCE: // DEC Abs
+    OP(0xCE) // DEC Abs
       DEC(AA_ABS);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0xD0: // BNE
-      BRA(!(F & FLAG_Z));
-      break;
+    OP(0xD0) // BNE
+      BRA(!IS_Z);
+      NEXT;
 
-    case 0xD1: // CMP (Zpg),Y
+    OP(0xD1) // CMP (Zpg),Y
       CMP(A_IY);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0xD5: // CMP Zpg,X
+    OP(0xD5) // CMP Zpg,X
       CMP(A_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xD6: // DEC Zpg,X
+    OP(0xD6) // DEC Zpg,X
       DEC(AA_ZPX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0xD8: // CLD
+    OP(0xD8) // CLD
       RSTF(FLAG_D);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xD9: // CMP Abs,Y
+    OP(0xD9) // CMP Abs,Y
       CMP(A_ABSY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xDD: // CMP Abs,X
+    OP(0xDD) // CMP Abs,X
       CMP(A_ABSX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xDE: // DEC Abs,X
+    OP(0xDE) // DEC Abs,X
       DEC(AA_ABSX);
       CLK(7);
-      break;
+      NEXT;
 
-    case 0xE0: // CPX #Oper
+    OP(0xE0) // CPX #Oper
       CPX(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xE1: // SBC (Zpg,X)
+    OP(0xE1) // SBC (Zpg,X)
       SBC(A_IX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0xE4: // CPX Zpg
+    OP(0xE4) // CPX Zpg
       CPX(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0xE5: // SBC Zpg
+    OP(0xE5) // SBC Zpg
       SBC(A_ZP);
       CLK(3);
-      break;
+      NEXT;
 
-    case 0xE6: // INC Zpg
+    OP(0xE6) // INC Zpg
       INC(AA_ZP);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0xE8: // INX
+    OP(0xE8) // INX
       ++X;
       TEST(X);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xE9: // SBC #Oper
+    OP(0xE9) // SBC #Oper
       SBC(A_IMM);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xEA: // NOP
+    OP(0xEA) // NOP
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xEC: // CPX Abs
+    OP(0xEC) // CPX Abs
       CPX(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xED: // SBC Abs
+    OP(0xED) // SBC Abs
       SBC(A_ABS);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xEE: // INC Abs
+    OP(0xEE) // INC Abs
       INC(AA_ABS);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0xF0: // BEQ
-      BRA(F & FLAG_Z);
-      break;
+    OP(0xF0) // BEQ
+      BRA(IS_Z);
+      NEXT;
 
-    case 0xF1: // SBC (Zpg),Y
+    OP(0xF1) // SBC (Zpg),Y
       SBC(A_IY);
       CLK(5);
-      break;
+      NEXT;
 
-    case 0xF5: // SBC Zpg,X
+    OP(0xF5) // SBC Zpg,X
       SBC(A_ZPX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xF6: // INC Zpg,X
+    OP(0xF6) // INC Zpg,X
       INC(AA_ZPX);
       CLK(6);
-      break;
+      NEXT;
 
-    case 0xF8: // SED
+    OP(0xF8) // SED
       SETF(FLAG_D);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0xF9: // SBC Abs,Y
+    OP(0xF9) // SBC Abs,Y
       SBC(A_ABSY);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xFD: // SBC Abs,X
+    OP(0xFD) // SBC Abs,X
       SBC(A_ABSX);
       CLK(4);
-      break;
+      NEXT;
 
-    case 0xFE: // INC Abs,X
+    OP(0xFE) // INC Abs,X
       INC(AA_ABSX);
       CLK(7);
-      break;
+      NEXT;
 
       /*-----------------------------------------------------------*/
       /*  Unlisted Instructions ( thanks to virtualnes )           */
       /*-----------------------------------------------------------*/
 
-    case 0x1A: // NOP (Unofficial)
-    case 0x3A: // NOP (Unofficial)
-    case 0x5A: // NOP (Unofficial)
-    case 0x7A: // NOP (Unofficial)
-    case 0xDA: // NOP (Unofficial)
-    case 0xFA: // NOP (Unofficial)
+    OP(0x1A) // NOP (Unofficial)
+    OP(0x3A) // NOP (Unofficial)
+    OP(0x5A) // NOP (Unofficial)
+    OP(0x7A) // NOP (Unofficial)
+    OP(0xDA) // NOP (Unofficial)
+    OP(0xFA) // NOP (Unofficial)
       CLK(2);
-      break;
-
-    case 0x80: // DOP (CYCLES 2)
-    case 0x82: // DOP (CYCLES 2)
-    case 0x89: // DOP (CYCLES 2)
-    case 0xC2: // DOP (CYCLES 2)
-    case 0xE2: // DOP (CYCLES 2)
-      PC++;
+      NEXT;
+
+    OP(0x80) // DOP (CYCLES 2)
+    OP(0x82) // DOP (CYCLES 2)
+    OP(0x89) // DOP (CYCLES 2)
+    OP(0xC2) // DOP (CYCLES 2)
+    OP(0xE2) // DOP (CYCLES 2)
+      SKIP(1);
       CLK(2);
-      break;
+      NEXT;
 
-    case 0x04: // DOP (CYCLES 3)
-    case 0x44: // DOP (CYCLES 3)
-    case 0x64: // DOP (CYCLES 3)
-      PC++;
+    OP(0x04) // DOP (CYCLES 3)
+    OP(0x44) // DOP (CYCLES 3)
+    OP(0x64) // DOP (CYCLES 3)
+      SKIP(1);
       CLK(3);
-      break;
-
-    case 0x14: // DOP (CYCLES 4)
-    case 0x34: // DOP (CYCLES 4)
-    case 0x54: // DOP (CYCLES 4)
-    case 0x74: // DOP (CYCLES 4)
-    case 0xD4: // DOP (CYCLES 4)
-    case 0xF4: // DOP (CYCLES 4)
-      PC++;
+      NEXT;
+
+    OP(0x14) // DOP (CYCLES 4)
+    OP(0x34) // DOP (CYCLES 4)
+    OP(0x54) // DOP (CYCLES 4)
+    OP(0x74) // DOP (CYCLES 4)
+    OP(0xD4) // DOP (CYCLES 4)
+    OP(0xF4) // DOP (CYCLES 4)
+      SKIP(1);
       CLK(4);
-      break;
-
-    case 0x0C: // TOP
-    case 0x1C: // TOP
-    case 0x3C: // TOP
-    case 0x5C: // TOP
-    case 0x7C: // TOP
-    case 0xDC: // TOP
-    case 0xFC: // TOP
-      PC += 2;
+      NEXT;
+
+    OP(0x0C) // TOP
+    OP(0x1C) // TOP
+    OP(0x3C) // TOP
+    OP(0x5C) // TOP
+    OP(0x7C) // TOP
+    OP(0xDC) // TOP
+    OP(0xFC) // TOP
+      SKIP(2);
       CLK(4);
-      break;
+      NEXT;
 
-    default: // Unknown Instruction
+    OP_DEFAULT // Unknown Instruction
       CLK(2);
 #if 0
         InfoNES_MessageBox( "0x%02x is unknown instruction.\n", byCode ) ;
 #endif
-      break;
+      NEXT;
 
+#if K6502_THREADED_DISPATCH
+  }
+end_of_step:
+#else
     } /* end of switch ( byCode ) */
 
   } /* end of while ... */
+#endif
+
+  // Write back the registers
+  ::PC = PC_NOW;
+  ::SP = SP;
+  ::F = GETF;
+  ::A = A;
+  ::X = X;
+  ::Y = Y;
 
   // Correct the number of the clocks
-  g_wCurrentClocks += (g_wPassedClocks - prePassedClocks);
-  g_wPassedClocks -= wClocks;
+  g_wCurrentClocks += (nClocks - prePassedClocks);
+  g_wPassedClocks = nClocks - wClocks;
+  dwStepBase += wClocks;
 }
 
 /*===================================================================*/
 /*                                                                   */
-/*  K6502_Step() :                                                   */
-/*          Only the specified number of the clocks execute Op.      */
+/*  K6502_Run() : Execute Op. until the clock reaches a deadline     */
 /*                                                                   */
 /*===================================================================*/
-void __not_in_flash_func(K6502_Step)(int wClocks)
+void __not_in_flash_func(K6502_Run)(DWORD dwClock)
 {
+  /*
+ *  Execute Op. until the clock reaches a deadline
+ *
+ *  Parameters
+ *    DWORD dwClock             (Read)
+ *      The deadline ( K6502_GetClocks )
+ *
+ *  Remarks
+ *    The last instruction may go past the deadline. The excess is
+ *    carried over to the next run.
+ *    An I/O write can end the run earlier with K6502_SetDeadline().
+ */
+
+  // Mappers may have switched the banks since the last step
+  K6502_SyncBanks();
+
   if (NMI_State != NMI_Wiring)
   {
     // NMI前に少し実行したい
     step(7);
-    wClocks -= 7;
   }
   procNMI();
-  step(wClocks);
+  step((int)(dwClock - dwStepBase));
 }
 
-// Addressing Op.
-// Data
-// Absolute,X
-static BYTE __not_in_flash_func(K6502_ReadAbsX)()
+/*===================================================================*/
+/*                                                                   */
+/*                  6502 Reading/Writing Operation                   */
+/*                                                                   */
+/*===================================================================*/
+#include "K6502_rw.h"
+
+// Page table
+BYTE *K6502_ReadPage[256];
+BYTE *K6502_WritePage[256];
+
+// The banks mapped in the page table ( SRAM, ROM BANK 0 - 3 )
+static BYTE *pbyMappedBank[5];
+
+static void K6502_MapBank(int nPage, BYTE *pbyBank)
 {
-  WORD wA0, wA1;
-  wA0 = AA_ABS;
-  wA1 = wA0 + X;
-  CLK((wA0 & 0x0100) != (wA1 & 0x0100));
-  return K6502_Read(wA1);
-};
-// Absolute,Y
-static BYTE __not_in_flash_func(K6502_ReadAbsY)()
+  // 8KB = 32 pages
+  for (int i = 0; i < 32; ++i)
+  {
+    K6502_ReadPage[nPage + i] = pbyBank ? pbyBank + i * 0x100 : NULL;
+  }
+}
+
+static void K6502_ResetPages()
 {
-  WORD wA0, wA1;
-  wA0 = AA_ABS;
-  wA1 = wA0 + Y;
-  CLK((wA0 & 0x0100) != (wA1 & 0x0100));
-  return K6502_Read(wA1);
-};
-// (Indirect),Y
-static BYTE __not_in_flash_func(K6502_ReadIY)()
+  // RAM ( 0x800 - 0x1fff is mirror of 0x0 - 0x7ff )
+  for (int i = 0; i < 0x20; ++i)
+  {
+    K6502_ReadPage[i] = K6502_WritePage[i] = &RAM[(i & 7) * 0x100];
+  }
+
+  // I/O goes the slow path. SRAM writes do, too ( MapperSram )
+  for (int i = 0x20; i < 0x100; ++i)
+  {
+    K6502_ReadPage[i] = K6502_WritePage[i] = NULL;
+  }
+
+  for (int i = 0; i < 5; ++i)
+  {
+    pbyMappedBank[i] = NULL;
+  }
+  K6502_SyncBanks();
+}
+
+void __not_in_flash_func(K6502_SyncBanks)()
 {
-  WORD wA0, wA1;
-  wA0 = K6502_ReadZpW(K6502_Read(PC++));
-  wA1 = wA0 + Y;
-  CLK((wA0 & 0x0100) != (wA1 & 0x0100));
-  return K6502_Read(wA1);
-};
+  BYTE *pbySram = ROM_SRAM ? SRAM : SRAMBANK;
+  if (pbyMappedBank[0] != pbySram)
+  {
+    pbyMappedBank[0] = pbySram;
+    K6502_MapBank(0x60, pbySram);
+  }
+
+  for (int i = 0; i < 4; ++i)
+  {
+    if (pbyMappedBank[i + 1] != ROMBANK[i])
+    {
+      pbyMappedBank[i + 1] = ROMBANK[i];
+      K6502_MapBank(0x80 + i * 0x20, ROMBANK[i]);
+    }
+  }
+}
+
+// An instruction byte read outside RAM, SRAM and ROM
+static BYTE byFetchBuf[4];
 
 /*===================================================================*/
 /*                                                                   */
-/*                  6502 Reading/Writing Operation                   */
+/*            K6502_Jump() : Set the instruction fetch window        */
 /*                                                                   */
 /*===================================================================*/
-#include "K6502_rw.h"
+static const BYTE *__attribute__((noinline)) __not_in_flash_func(K6502_Jump)(WORD wAddr)
+{
+  /*
+ *  Set the instruction fetch window at an address
+ *
+ *  Parameters
+ *    WORD wAddr              (Read)
+ *      New PC
+ *
+ *  Return values
+ *    Pointer to the byte at wAddr ( pbyFetchEnd if it isn't in memory )
+ *
+ *  Remarks
+ *    RAM windows are 2KB ( mirrors ), the others are 8KB banks.
+ *    Mapper reads never switch the banks, so only the writes that miss
+ *    the page table need to set the window again ( WRITE ).
+ */
+  WORD wSize = wAddr < 0x2000 ? 0x800 : 0x2000;
+  WORD wBank = wAddr & ~(wSize - 1);
+  BYTE *pbyBank = K6502_ReadPage[wBank >> 8];
+  if (pbyBank)
+  {
+    pbyFetchBase = pbyBank;
+    pbyFetchEnd = pbyBank + wSize;
+    wFetchBase = wBank;
+    return pbyBank + (wAddr - wBank);
+  }
+
+  // The byte is read by K6502_Refill() when it's fetched
+  pbyFetchBase = pbyFetchEnd = byFetchBuf;
+  wFetchBase = wAddr;
+  return byFetchBuf;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*      K6502_Refill() : Fetch beyond the end of the window          */
+/*                                                                   */
+/*===================================================================*/
+static const BYTE *__attribute__((noinline)) __not_in_flash_func(K6502_Refill)(const BYTE *pbyPC)
+{
+  /*
+ *  Fetch beyond the end of the window
+ *
+ *  Parameters
+ *    const BYTE *pbyPC       (Read)
+ *      Current fetch pointer
+ *
+ *  Return values
+ *    Pointer to the byte at PC ( before pbyFetchEnd )
+ *
+ *  Remarks
+ *    Outside memory, the byte is read with K6502_Read() into a buffer,
+ *    one at a time, so that I/O sees the same reads as before.
+ *    The buffer's window is empty ( pbyFetchBase == pbyFetchEnd ), so
+ *    that a branch never lands in it.
+ */
+  WORD wAddr = wFetchBase + (pbyPC - pbyFetchBase);
+
+  pbyPC = K6502_Jump(wAddr);
+  if (pbyPC < pbyFetchEnd)
+  {
+    return pbyPC;
+  }
+
+  byFetchBuf[0] = K6502_Read(wAddr);
+  pbyFetchBase = pbyFetchEnd = byFetchBuf + 1;
+  wFetchBase = wAddr + 1;
+  return byFetchBuf;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*        K6502_WriteIO() : Write that misses the page table         */
+/*                                                                   */
+/*===================================================================*/
+static const BYTE *__attribute__((noinline)) __not_in_flash_func(K6502_WriteIO)(WORD wAddr, BYTE byData, const BYTE *pbyPC)
+{
+  /*
+ *  Write that misses the page table
+ *
+ *  Parameters
+ *    WORD wAddr              (Read)
+ *      Address to write
+ *
+ *    BYTE byData             (Read)
+ *      Data to write
+ *
+ *    const BYTE *pbyPC       (Read)
+ *      Current fetch pointer
+ *
+ *  Return values
+ *    Fetch pointer in the window set again
+ */
+  WORD wPC = wFetchBase + (pbyPC - pbyFetchBase);
+
+  K6502_Write(wAddr, byData);
+  return K6502_Jump(wPC);
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*      K6502_IsIdleLoop() : Check the body of a polling loop        */
+/*                                                                   */
+/*===================================================================*/
+static bool __attribute__((noinline)) __not_in_flash_func(K6502_IsIdleLoop)(const BYTE *pbyOp, const BYTE *pbyBranch)
+{
+  /*
+ *  Check the body of a polling loop
+ *
+ *  Parameters
+ *    const BYTE *pbyOp         (Read)
+ *      The first instruction of the loop
+ *
+ *    const BYTE *pbyBranch     (Read)
+ *      The branch back to pbyOp
+ *
+ *  Return values
+ *    true if the loop goes straight to the branch and has no side effect
+ *
+ *  Remarks
+ *    Loads, compares and logical operations on immediate, zero page or
+ *    absolute operands, and some register operations are allowed.
+ *    Absolute operands must be RAM, the PPU status, SRAM or ROM.
+ */
+  WORD wAddr;
+
+  if (pbyBranch - pbyOp > 16)
+  {
+    return false;
+  }
+
+  while (pbyOp < pbyBranch)
+  {
+    switch (*pbyOp)
+    {
+    case 0xaa: // TAX
+    case 0xa8: // TAY
+    case 0x8a: // TXA
+    case 0x98: // TYA
+    case 0x18: // CLC
+    case 0x38: // SEC
+    case 0xb8: // CLV
+    case 0xea: // NOP
+      pbyOp += 1;
+      break;
+
+    case 0xa9: // LDA #Oper
+    case 0xa5: // LDA Zpg
+    case 0xa2: // LDX #Oper
+    case 0xa6: // LDX Zpg
+    case 0xa0: // LDY #Oper
+    case 0xa4: // LDY Zpg
+    case 0x24: // BIT Zpg
+    case 0xc9: // CMP #Oper
+    case 0xc5: // CMP Zpg
+    case 0xe0: // CPX #Oper
+    case 0xe4: // CPX Zpg
+    case 0xc0: // CPY #Oper
+    case 0xc4: // CPY Zpg
+    case 0x29: // AND #Oper
+    case 0x25: // AND Zpg
+    case 0x09: // ORA #Oper
+    case 0x05: // ORA Zpg
+    case 0x49: // EOR #Oper
+    case 0x45: // EOR Zpg
+      pbyOp += 2;
+      break;
+
+    case 0xad: // LDA Abs
+    case 0xae: // LDX Abs
+    case 0xac: // LDY Abs
+    case 0x2c: // BIT Abs
+    case 0xcd: // CMP Abs
+    case 0xec: // CPX Abs
+    case 0xcc: // CPY Abs
+    case 0x2d: // AND Abs
+    case 0x0d: // ORA Abs
+    case 0x4d: // EOR Abs
+      if (pbyBranch - pbyOp < 3)
+      {
+        return false;
+      }
+      wAddr = pbyOp[1] | (WORD)pbyOp[2] << 8;
+      if (wAddr >= 0x2000 && wAddr < 0x6000 && (wAddr & 0xe007) != 0x2002)
+      {
+        return false;
+      }
+      pbyOp += 3;
+      break;
+
+    default:
+      return false;
+    }
+  }
+  return pbyOp == pbyBranch;
+}
+
+// Reading an instruction byte for K6502_Decode()
+static inline BYTE K6502_DecodeFetch(const BYTE *&pbyPC)
+{
+  if (pbyPC >= pbyFetchEnd)
+  {
+    pbyPC = K6502_Refill(pbyPC);
+  }
+  return *pbyPC++;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*          K6502_Decode() : Decode an instruction at PC             */
+/*                                                                   */
+/*===================================================================*/
+static const struct K6502_Decode_tag *__attribute__((noinline)) __not_in_flash_func(K6502_Decode)(const BYTE *pbyPC)
+{
+  /*
+ *  Decode an instruction at PC
+ *
+ *  Parameters
+ *    const BYTE *pbyPC       (Read)
+ *      Current fetch pointer
+ *
+ *  Return values
+ *    Decoded instruction. The fetch continues at pbyOp + byLength.
+ *
+ *  Remarks
+ *    An instruction in a ROM bank is stored in K6502_DecodeCache.
+ *    Anything else is read byte by byte as before ( K6502_Refill ), into
+ *    an entry that isn't cached.
+ */
+  static struct K6502_Decode_tag decoded;
+  struct K6502_Decode_tag *pDecode;
+  BYTE byCode;
+  int nBytes;
+
+  if (wFetchBase >= 0x8000 && pbyPC < pbyFetchEnd && pbyFetchEnd - pbyPC >= 3)
+  {
+    byCode = pbyPC[0];
+    nBytes = K6502_OperandBytes[byCode];
+
+    pDecode = &K6502_DecodeCache[(uintptr_t)pbyPC & (K6502_DECODE_CACHE_SIZE - 1)];
+    pDecode->pbyOp = pbyPC;
+    pDecode->byCode = byCode;
+    pDecode->byLength = 1 + nBytes;
+    pDecode->wOperand = nBytes == 0   ? 0
+                        : nBytes == 1 ? pbyPC[1]
+                                      : pbyPC[1] | (WORD)pbyPC[2] << 8;
+    return pDecode;
+  }
+
+  decoded.byCode = byCode = K6502_DecodeFetch(pbyPC);
+  nBytes = K6502_OperandBytes[byCode];
+  decoded.wOperand = 0;
+  if (nBytes > 0)
+  {
+    decoded.wOperand = K6502_DecodeFetch(pbyPC);
+  }
+  if (nBytes > 1)
+  {
+    decoded.wOperand |= (WORD)K6502_DecodeFetch(pbyPC) << 8;
+  }
+  decoded.pbyOp = pbyPC;
+  decoded.byLength = 0;
+  return &decoded;
+}
@@ -54,7 +54,8 @@ typedef unsigned char BYTE;
 void K6502_Init();
 void K6502_Reset();
 void K6502_Set_Int_Wiring(BYTE byNMI_Wiring, BYTE byIRQ_Wiring);
-void K6502_Step(int wClocks);
+void K6502_Run(DWORD dwClock);
+void K6502_SyncBanks();
 
 // I/O Operation (User definition)
 static inline BYTE K6502_Read(WORD wAddr);
@@ -62,9 +63,6 @@ static inline WORD K6502_ReadW(WORD wAddr);
 static inline WORD K6502_ReadW2(WORD wAddr);
 static inline BYTE K6502_ReadZp(BYTE byAddr);
 static inline WORD K6502_ReadZpW(BYTE byAddr);
-static inline BYTE K6502_ReadAbsX();
-static inline BYTE K6502_ReadAbsY();
-static inline BYTE K6502_ReadIY();
 
 static inline void K6502_Write(WORD wAddr, BYTE byData);
 static inline void K6502_WriteW(WORD wAddr, WORD wData);
@@ -81,4 +79,32 @@ extern WORD PC;
 //extern WORD g_wPassedClocks;
 WORD getPassedClocks();
 
+// The clock since the reset ( CPU cycles, wraps around )
+DWORD K6502_GetClocks();
+
+// End the current K6502_Run() at an earlier clock
+void K6502_SetDeadline(DWORD dwClock);
+
+#ifdef K6502_COUNT_INSTRUCTIONS
+// The number of the executed instructions
+extern DWORD g_dwInstructions;
+#endif
+
+// The number of the clocks skipped in idle loops
+extern DWORD g_dwIdleClocks;
+
+// Register set
+struct K6502_Regs_tag
+{
+  WORD PC;
+  BYTE SP;
+  BYTE F;
+  BYTE A;
+  BYTE X;
+  BYTE Y;
+};
+
+// Get the registers ( between K6502_Run() calls )
+void K6502_GetRegs(struct K6502_Regs_tag *pRegs);
+
 #endif /* !K6502_H_INCLUDED */
@@ -17,9 +17,22 @@
 #include "InfoNES.h"
 #include "InfoNES_System.h"
 #include "InfoNES_pAPU.h"
+#include "InfoNES_Pipe.h"
 #include <pico.h>
 #include <stdio.h>
 
+/*-------------------------------------------------------------------*/
+/*  Page table                                                       */
+/*-------------------------------------------------------------------*/
+
+/*
+ *  A pointer per 256 bytes page of the CPU address space.
+ *  NULL means the page isn't plain memory ( I/O, mapper registers ).
+ *  K6502_SyncBanks() updates the ROM/SRAM pages after a bank switch.
+ */
+extern BYTE *K6502_ReadPage[256];
+extern BYTE *K6502_WritePage[256];
+
 /*===================================================================*/
 /*                                                                   */
 /*            K6502_ReadZp() : Reading from the zero page            */
@@ -68,6 +81,12 @@ static inline BYTE __not_in_flash_func(K6502_Read)(WORD wAddr)
  */
   BYTE byRet;
 
+  BYTE *pbyPage = K6502_ReadPage[wAddr >> 8];
+  if (pbyPage)
+  {
+    return pbyPage[wAddr & 0xff];
+  }
+
   if (wAddr >= 0x8000)
   {
     return ROMBANK[(wAddr - 0x8000) >> 13][wAddr & 0x1fff];
@@ -125,7 +144,7 @@ static inline BYTE __not_in_flash_func(K6502_Read)(WORD wAddr)
     if (wAddr == 0x4015)
     {
       // APU control
-      byRet = APU_Reg[0x4015];
+      byRet = APU_Reg[0x15] & 0x40;
       if (ApuC1Atl > 0)
         byRet |= (1 << 0);
       if (ApuC2Atl > 0)
@@ -144,7 +163,7 @@ static inline BYTE __not_in_flash_func(K6502_Read)(WORD wAddr)
         byRet |= (1 << 3);
 
       // FrameIRQ
-      APU_Reg[0x4015] &= ~0x40;
+      APU_Reg[0x15] &= ~0x40;
       return byRet;
     }
     else if (wAddr == 0x4016)
@@ -164,7 +183,9 @@ static inline BYTE __not_in_flash_func(K6502_Read)(WORD wAddr)
     else
     {
       /* Return Mapper Register*/
-      return MapperReadApu(wAddr);
+      byRet = MapperReadApu(wAddr);
+      K6502_SyncBanks();
+      return byRet;
     }
     break;
     // The other sound registers are not readable.
@@ -222,6 +243,13 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
  *
  */
 
+  BYTE *pbyPage = K6502_WritePage[wAddr >> 8];
+  if (pbyPage)
+  {
+    pbyPage[wAddr & 0xff] = byData;
+    return;
+  }
+
   switch (wAddr & 0xe000)
   {
   case 0x0000: /* RAM */
@@ -235,11 +263,13 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
     switch (wAddr & 0x7)
     {
     case 0: /* 0x2000 */
+      if (PPULogOn && ((PPU_R0 ^ byData) & R0_BG_ADDR))
+        InfoNES_LogPPU(PPU_LOG_R0, 0, PPU_R0);
       PPU_R0 = byData;
       PPU_Increment = (PPU_R0 & R0_INC_ADDR) ? 32 : 1;
       PPU_NameTableBank = NAME_TABLE0 + (PPU_R0 & R0_NAME_ADDR);
-      PPU_BG_Base = (PPU_R0 & R0_BG_ADDR) ? ChrBuf + 256 * 64 : ChrBuf;
-      PPU_SP_Base = (PPU_R0 & R0_SP_ADDR) ? ChrBuf + 256 * 64 : ChrBuf;
+      PPU_BG_Base = (PPU_R0 & R0_BG_ADDR) ? 0x1000 : 0x0000;
+      PPU_SP_Base = (PPU_R0 & R0_SP_ADDR) ? 0x1000 : 0x0000;
       PPU_SP_Height = (PPU_R0 & R0_SP_SIZE) ? 16 : 8;
 
       // Account for Loopy's scrolling discoveries
@@ -247,6 +277,8 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
       break;
 
     case 1: /* 0x2001 */
+      if (PPULogOn && PPU_R1 != byData)
+        InfoNES_LogPPU(PPU_LOG_R1, 0, PPU_R1);
       PPU_R1 = byData;
       break;
 
@@ -264,6 +296,11 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
     case 4: /* 0x2004 */
       // Write data to Sprite RAM
       SPRRAM[PPU_R3++] = byData;
+      SprLineUpdate = 1;
+#if INFONES_RENDER_PIPE
+      if (RenderPipe)
+        InfoNES_PipeOam((BYTE)(PPU_R3 - 1));
+#endif
       break;
 
     case 5: /* 0x2005 */
@@ -285,6 +322,8 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
         //PPU_Scr_H_Next = byData;
         //PPU_Scr_H_Byte_Next = PPU_Scr_H_Next >> 3;
         //PPU_Scr_H_Bit_Next = PPU_Scr_H_Next & 7;
+        if (PPULogOn && PPU_Scr_H_Bit != (byData & 7))
+          InfoNES_LogPPU(PPU_LOG_H_BIT, 0, PPU_Scr_H_Bit);
         PPU_Scr_H_Bit = byData & 7;
 
         // Added : more Loopy Stuff
@@ -302,6 +341,8 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
             PPU_Addr = ( PPU_Addr & 0xff00 ) | ( (WORD)byData );
 #else
         PPU_Temp = (PPU_Temp & 0xFF00) | (((WORD)byData) & 0x00FF);
+        if (PPULogOn && PPU_Addr != PPU_Temp)
+          InfoNES_LogPPU(PPU_LOG_ADDR, 0, PPU_Addr);
         PPU_Addr = PPU_Temp;
 #endif
         InfoNES_SetupScr();
@@ -327,32 +368,72 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
       PPU_Addr += PPU_Increment;
       addr &= 0x3fff;
 
+#if INFONES_RENDER_PIPE
+      // Core 1 draws from a copy of PPU RAM
+      if (RenderPipe && addr < 0x3f00 && InfoNES_PipeVram(addr, byData))
+        break;
+#endif
+
       // Write to PPU Memory
       if (addr < 0x2000 && byVramWriteEnable)
       {
         // Pattern Data
-        ChrBufUpdate |= (1 << (addr >> 10));
         PPUBANK[addr >> 10][addr & 0x3ff] = byData;
+        InfoNES_ChrWrite(addr);
       }
       else if (addr < 0x3f00) /* 0x2000 - 0x3eff */
       {
-        // Name Table and mirror
-        PPUBANK[addr >> 10][addr & 0x3ff] = byData;
-        PPUBANK[(addr ^ 0x1000) >> 10][addr & 0x3ff] = byData;
+        // Name Table and mirror, CHR-ROM ignores the write
+        if (!InfoNES_IsVRom(PPUBANK[addr >> 10]))
+          PPUBANK[addr >> 10][addr & 0x3ff] = byData;
+        if (!InfoNES_IsVRom(PPUBANK[(addr ^ 0x1000) >> 10]))
+          PPUBANK[(addr ^ 0x1000) >> 10][addr & 0x3ff] = byData;
+
+        // A write to pattern RAM lands here as well while VROM is mapped
+        if (addr < 0x2000)
+        {
+          InfoNES_ChrWrite(addr);
+          InfoNES_ChrWrite(addr ^ 0x1000);
+        }
+        else if ((addr & 0x3c0) == 0x3c0)
+        {
+          // Attribute table
+          InfoNES_AttrWrite(PPUBANK[addr >> 10], addr & 0x3ff);
+          if (PPUBANK[(addr ^ 0x1000) >> 10] != PPUBANK[addr >> 10])
+            InfoNES_AttrWrite(PPUBANK[(addr ^ 0x1000) >> 10], addr & 0x3ff);
+        }
       }
       else if (!(addr & 0xf)) /* 0x3f00 or 0x3f10 */
       {
+        if (PPULogOn)
+          InfoNES_LogPPU(PPU_LOG_PAL, 0, PalTable[0x00]);
+
         // Palette mirror
         PPURAM[0x3f10] = PPURAM[0x3f14] = PPURAM[0x3f18] = PPURAM[0x3f1c] =
             PPURAM[0x3f00] = PPURAM[0x3f04] = PPURAM[0x3f08] = PPURAM[0x3f0c] = byData;
         PalTable[0x00] = PalTable[0x04] = PalTable[0x08] = PalTable[0x0c] =
             PalTable[0x10] = PalTable[0x14] = PalTable[0x18] = PalTable[0x1c] = NesPalette[byData] | 0x8000;
+#if INFONES_RENDER_PIPE
+        if (RenderPipe)
+          InfoNES_PipePal(0);
+        else
+#endif
+          PalPairUpdate = 0xf;
       }
       else if (addr & 3)
       {
         // Palette
+        if (PPULogOn)
+          InfoNES_LogPPU(PPU_LOG_PAL, addr & 0x1f, PalTable[addr & 0x1f]);
         PPURAM[addr] = byData;
         PalTable[addr & 0x1f] = NesPalette[byData];
+#if INFONES_RENDER_PIPE
+        if (RenderPipe)
+          InfoNES_PipePal(addr & 0x1f);
+        else
+#endif
+        if (!(addr & 0x10))
+          PalPairUpdate |= 1 << ((addr >> 2) & 3);
       }
     }
     break;
@@ -389,6 +470,7 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
 
     case 0x14: /* 0x4014 */
       // Sprite DMA
+      SprLineUpdate = 1;
       switch (byData >> 5)
       {
       case 0x0: /* RAM */
@@ -415,10 +497,16 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
         InfoNES_MemoryCopy(SPRRAM, &ROMBANK3[((WORD)byData << 8) & 0x1fff], SPRRAM_SIZE);
         break;
       }
+#if INFONES_RENDER_PIPE
+      if (RenderPipe)
+        InfoNES_PipeOamDma();
+#endif
       break;
 
     case 0x15: /* 0x4015 */
       InfoNES_pAPUWriteControl(wAddr, byData);
+      // Bit 6 keeps the Frame IRQ flag
+      byData = (byData & ~0x40) | (APU_Reg[0x15] & 0x40);
 #if 0
           /* Unknown */
           if ( byData & 0x10 ) 
@@ -439,14 +527,15 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
 
     case 0x17: /* 0x4017 */
       // Frame IRQ
-      FrameStep = 0;
       if (!(byData & 0xc0))
       {
         FrameIRQ_Enable = 1;
+        InfoNES_SetEvent(EVENT_FRAME_IRQ, K6502_GetClocks() + STEP_PER_FRAME);
       }
       else
       {
         FrameIRQ_Enable = 0;
+        InfoNES_ClearEvent(EVENT_FRAME_IRQ);
       }
       break;
     }
@@ -459,7 +548,11 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
     else
     {
       /* Write to APU */
-      MapperApu(wAddr, byData);
+      if (PPULogOn)
+        InfoNES_LogMapper(MapperApu, wAddr, byData);
+      else
+        MapperApu(wAddr, byData);
+      K6502_SyncBanks();
     }
     break;
 
@@ -470,7 +563,11 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
     /* Write to SRAM, when no SRAM */
     if (!ROM_SRAM)
     {
-      MapperSram(wAddr, byData);
+      if (PPULogOn)
+        InfoNES_LogMapper(MapperSram, wAddr, byData);
+      else
+        MapperSram(wAddr, byData);
+      K6502_SyncBanks();
     }
     break;
 
@@ -478,8 +575,12 @@ static inline void __not_in_flash_func(K6502_Write)(WORD wAddr, BYTE byData)
   case 0xa000: /* ROM BANK 1 */
   case 0xc000: /* ROM BANK 2 */
   case 0xe000: /* ROM BANK 3 */
-    // Write to Mapper
-    MapperWrite(wAddr, byData);
+    // Write to Mapper ( a bank switch may split the scanline )
+    if (PPULogOn)
+      InfoNES_LogMapper(MapperWrite, wAddr, byData);
+    else
+      MapperWrite(wAddr, byData);
+    K6502_SyncBanks();
     break;
   }
 }
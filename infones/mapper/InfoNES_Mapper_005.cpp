@@ -213,6 +213,8 @@ void Map5_Apu(WORD wAddr, BYTE byData)
     byData &= 0x03;
     byData = byData | (byData << 2) | (byData << 4) | (byData << 6);
     InfoNES_MemorySet(&(Map5_Ex_Nam[0x3c0]), byData, 0x400 - 0x3c0);
+    for (int nOfs = 0x3c0; nOfs < 0x400; ++nOfs)
+      InfoNES_AttrWrite(Map5_Ex_Nam, nOfs);
     break;
 
   case 0x5113:
@@ -288,6 +290,7 @@ void Map5_Apu(WORD wAddr, BYTE byData)
       {
       case 0:
         Map5_Ex_Vram[wAddr - 0x5c00] = byData;
+        InfoNES_AttrWrite(Map5_Ex_Vram, wAddr - 0x5c00);
         break;
       case 2:
         Map5_Ex_Ram[wAddr - 0x5c00] = byData;
@@ -9,6 +9,7 @@ BYTE Map19_Regs[2];
 
 BYTE Map19_IRQ_Enable;
 DWORD Map19_IRQ_Cnt;
+DWORD Map19_IRQ_Clock;
 
 /* The address of 1Kbytes unit of the Map19 Chr RAM */
 #define Map19_VROMPAGE(a) &Map19_Chr_Ram[(a)*0x400]
@@ -37,7 +38,10 @@ void Map19_Init()
   MapperVSync = Map0_VSync;
 
   /* Callback at HSync */
-  MapperHSync = Map19_HSync;
+  MapperHSync = Map0_HSync;
+
+  /* Callback at EVENT_MAPPER */
+  MapperEvent = Map19_Event;
 
   /* Callback at PPU */
   MapperPPU = Map0_PPU;
@@ -74,6 +78,11 @@ void Map19_Init()
   Map19_Regs[1] = 0x00;
   Map19_Regs[2] = 0x00;
 
+  /* Initialize IRQ Reg */
+  Map19_IRQ_Enable = 0;
+  Map19_IRQ_Cnt = 0;
+  Map19_IRQ_Clock = 0;
+
   /* Set up wiring of the interrupt pin */
   K6502_Set_Int_Wiring(1, 1);
 }
@@ -283,12 +292,16 @@ void Map19_Apu(WORD wAddr, BYTE byData)
     break;
 
   case 0x5000: /* $5000-57ff */
+    Map19_Sync_IRQ();
     Map19_IRQ_Cnt = (Map19_IRQ_Cnt & 0xff00) | byData;
+    Map19_Set_IRQ();
     break;
 
   case 0x5800: /* $5800-5fff */
+    Map19_Sync_IRQ();
     Map19_IRQ_Cnt = (Map19_IRQ_Cnt & 0x00ff) | ((DWORD)(byData & 0x7f) << 8);
     Map19_IRQ_Enable = (byData & 0x80) >> 7;
+    Map19_Set_IRQ();
     break;
   }
 }
@@ -308,9 +321,11 @@ BYTE Map19_ReadApu(WORD wAddr)
     return (BYTE)(wAddr >> 8);
 
   case 0x5000: /* $5000-57ff */
+    Map19_Sync_IRQ();
     return (BYTE)(Map19_IRQ_Cnt & 0x00ff);
 
   case 0x5800: /* $5800-5fff */
+    Map19_Sync_IRQ();
     return (BYTE)((Map19_IRQ_Cnt & 0x7f00) >> 8);
 
   default:
@@ -319,26 +334,51 @@ BYTE Map19_ReadApu(WORD wAddr)
 }
 
 /*-------------------------------------------------------------------*/
-/*  Mapper 19 H-Sync Function                                        */
+/*  Mapper 19 Event Function                                         */
 /*-------------------------------------------------------------------*/
-void Map19_HSync()
+void Map19_Event()
 {
   /*
- *  Callback at HSync
+ *  Callback at EVENT_MAPPER
  *
  */
-  BYTE Map19_IRQ_Timing = 113;
+  Map19_IRQ_Cnt = 0x7fff;
+  Map19_IRQ_Clock = K6502_GetClocks();
+  IRQ_REQ;
+}
 
-  if (Map19_IRQ_Enable)
+/*-------------------------------------------------------------------*/
+/*  Mapper 19 Count up the IRQ counter                               */
+/*-------------------------------------------------------------------*/
+void Map19_Sync_IRQ()
+{
+  /*
+ *  Remarks
+ *    In the middle of K6502_Run(), the clock is the one at the last I/O
+ *    write, so a read may be behind by up to a scanline.
+ */
+  DWORD dwClock = K6502_GetClocks();
+  if (Map19_IRQ_Enable && Map19_IRQ_Cnt < 0x7fff)
   {
-    if (Map19_IRQ_Cnt >= (DWORD)(0x7fff - Map19_IRQ_Timing))
-    {
+    Map19_IRQ_Cnt += dwClock - Map19_IRQ_Clock;
+    if (Map19_IRQ_Cnt > 0x7fff)
       Map19_IRQ_Cnt = 0x7fff;
-      IRQ_REQ;
-    }
-    else
-    {
-      Map19_IRQ_Cnt += Map19_IRQ_Timing;
-    }
+  }
+  Map19_IRQ_Clock = dwClock;
+}
+
+/*-------------------------------------------------------------------*/
+/*  Mapper 19 Set the IRQ event                                      */
+/*-------------------------------------------------------------------*/
+void Map19_Set_IRQ()
+{
+  /* IRQ when the counter reaches 0x7fff */
+  if (Map19_IRQ_Enable && Map19_IRQ_Cnt < 0x7fff)
+  {
+    InfoNES_SetEvent(EVENT_MAPPER, Map19_IRQ_Clock + 0x7fff - Map19_IRQ_Cnt);
+  }
+  else
+  {
+    InfoNES_ClearEvent(EVENT_MAPPER);
   }
 }
@@ -6,6 +6,7 @@
 
 BYTE  Map69_IRQ_Enable;
 DWORD Map69_IRQ_Cnt;
+DWORD Map69_IRQ_Clock;
 BYTE  Map69_Regs[ 1 ];
 
 /*-------------------------------------------------------------------*/
@@ -32,7 +33,10 @@ void Map69_Init()
   MapperVSync = Map0_VSync;
 
   /* Callback at HSync */
-  MapperHSync = Map69_HSync;
+  MapperHSync = Map0_HSync;
+
+  /* Callback at EVENT_MAPPER */
+  MapperEvent = Map69_Event;
 
   /* Callback at PPU */
   MapperPPU = Map0_PPU;
@@ -60,6 +64,7 @@ void Map69_Init()
   /* Initialize IRQ Reg */
   Map69_IRQ_Enable = 0;
   Map69_IRQ_Cnt    = 0;
+  Map69_IRQ_Clock  = 0;
 
   /* Set up wiring of the interrupt pin */
   K6502_Set_Int_Wiring( 1, 1 ); 
@@ -139,15 +144,21 @@ void Map69_Write( WORD wAddr, BYTE byData )
           break;
 
         case 0x0d:
+          Map69_Sync_IRQ();
           Map69_IRQ_Enable = byData;
+          Map69_Set_IRQ();
           break;
 
         case 0x0e:
+          Map69_Sync_IRQ();
           Map69_IRQ_Cnt = ( Map69_IRQ_Cnt & 0xff00) | (DWORD)byData;
+          Map69_Set_IRQ();
           break;
 
         case 0x0f:
+          Map69_Sync_IRQ();
           Map69_IRQ_Cnt = ( Map69_IRQ_Cnt & 0x00ff) | ( (DWORD)byData << 8 );
+          Map69_Set_IRQ();
           break;
       }
       break;
@@ -155,22 +166,46 @@ void Map69_Write( WORD wAddr, BYTE byData )
 }
 
 /*-------------------------------------------------------------------*/
-/*  Mapper 69 H-Sync Function                                        */
+/*  Mapper 69 Event Function                                         */
 /*-------------------------------------------------------------------*/
-void Map69_HSync()
+void Map69_Event()
 {
 /*
- *  Callback at HSync
+ *  Callback at EVENT_MAPPER
  *
  */
-  if ( Map69_IRQ_Enable )
+  IRQ_REQ;
+
+  /* The counter went past 0 at the event */
+  Map69_IRQ_Clock += Map69_IRQ_Cnt + 1;
+  Map69_IRQ_Cnt = 0xffff;
+  Map69_Set_IRQ();
+}
+
+/*-------------------------------------------------------------------*/
+/*  Mapper 69 Count down the IRQ counter                             */
+/*-------------------------------------------------------------------*/
+void Map69_Sync_IRQ()
+{
+  /* Bit 7 : Counter enable ( 1 per CPU clock ) */
+  DWORD dwClock = K6502_GetClocks();
+  if ( Map69_IRQ_Enable & 0x80 )
+  {
+    Map69_IRQ_Cnt = ( Map69_IRQ_Cnt - ( dwClock - Map69_IRQ_Clock ) ) & 0xffff;
+  }
+  Map69_IRQ_Clock = dwClock;
+}
+
+/*-------------------------------------------------------------------*/
+/*  Mapper 69 Set the IRQ event                                      */
+/*-------------------------------------------------------------------*/
+void Map69_Set_IRQ()
+{
+  /* Bit 0 : IRQ enable ( when the counter goes past 0 ) */
+  if ( ( Map69_IRQ_Enable & 0x81 ) == 0x81 )
   {
-    if ( Map69_IRQ_Cnt <= 113 )
-    {
-      IRQ_REQ;
-      Map69_IRQ_Cnt = 0;
-    } else {
-      Map69_IRQ_Cnt -= 113;
-    }
+    InfoNES_SetEvent( EVENT_MAPPER, Map69_IRQ_Clock + Map69_IRQ_Cnt + 1 );
+  } else {
+    InfoNES_ClearEvent( EVENT_MAPPER );
   }
 }
@@ -20,10 +20,12 @@
 #include <string.h>
 #include <stdarg.h>
 #include <algorithm>
+#include <atomic>
 
 #include <InfoNES.h>
 #include <InfoNES_System.h>
 #include <InfoNES_pAPU.h>
+#include <InfoNES_Pipe.h>
 
 #include <dvi/dvi.h>
 #include <tusb.h>
@@ -55,6 +57,8 @@ namespace
 
     std::unique_ptr<dvi::DVI> dvi_;
 
+    constexpr int AudioBufferSize = 256;
+
     static constexpr uintptr_t NES_FILE_ADDR = 0x10080000;
 
     ROMSelector romSelector_;
@@ -165,6 +169,66 @@ void loadNVRAM()
     SRAMwritten = false;
 }
 
+namespace
+{
+    // Frame skip governor
+    //   FrameSkip goes up when core0 falls behind the scan out (the line
+    //   buffers are ready at once and the audio ring runs low) and down
+    //   again when getLineBuffer() keeps blocking.
+    constexpr int MaxFrameSkip = 3;
+    constexpr uint32_t LineWaitBusyUS = 200;   // per drawn frame
+    constexpr uint32_t LineWaitSpareUS = 2000; // per drawn frame
+    constexpr int AudioLowSamples = AudioBufferSize / 4;
+    constexpr int RaiseFrames = 2;  // drawn frames behind in a row
+    constexpr int LowerFrames = 60; // drawn frames with time to spare in a row
+    constexpr int AudioPaceSamples = APU_BATCH_SAMPLES; // the samples of a batch of scanlines
+
+    uint32_t lineWaitUS_ = 0;
+    int behindCount_ = 0;
+    int spareCount_ = 0;
+    uint32_t emulatedFrames_ = 0;
+    uint32_t drawnFrames_ = 0;
+    uint32_t reportFrame_ = 0;
+
+    int getBufferedSamples()
+    {
+        return AudioBufferSize - dvi_->getAudioRingBuffer().getFullWritableSize();
+    }
+
+    // Called once per drawn frame
+    void governFrameSkip()
+    {
+        bool behind = lineWaitUS_ < LineWaitBusyUS &&
+                      getBufferedSamples() < AudioLowSamples;
+        bool spare = lineWaitUS_ > LineWaitSpareUS;
+        lineWaitUS_ = 0;
+
+        behindCount_ = behind ? behindCount_ + 1 : 0;
+        spareCount_ = spare ? spareCount_ + 1 : 0;
+
+        if (behindCount_ >= RaiseFrames && FrameSkip < MaxFrameSkip)
+        {
+            ++FrameSkip;
+            behindCount_ = 0;
+        }
+        else if (spareCount_ >= LowerFrames && FrameSkip > 0)
+        {
+            --FrameSkip;
+            spareCount_ = 0;
+        }
+
+        ++drawnFrames_;
+        uint32_t frame = dvi_->getFrameCounter();
+        if (frame - reportFrame_ >= 60 * 60)
+        {
+            printf("frame skip %d, %d frames dropped/min\n",
+                   FrameSkip, static_cast<int>(emulatedFrames_ - drawnFrames_));
+            emulatedFrames_ = drawnFrames_ = 0;
+            reportFrame_ = frame;
+        }
+    }
+}
+
 void InfoNES_PadState(DWORD *pdwPad1, DWORD *pdwPad2, DWORD *pdwSystem)
 {
     static constexpr int LEFT = 1 << 6;
@@ -181,6 +245,7 @@ void InfoNES_PadState(DWORD *pdwPad1, DWORD *pdwPad2, DWORD *pdwSystem)
     static int rapidFireCounter = 0;
 
     ++rapidFireCounter;
+    ++emulatedFrames_;
     bool reset = false;
 
     for (int i = 0; i < 2; ++i)
@@ -317,10 +382,18 @@ void InfoNES_SoundClose()
 
 int __not_in_flash_func(InfoNES_GetSoundBufferSize)()
 {
-    return dvi_->getAudioRingBuffer().getFullWritableSize();
+    auto &ring = dvi_->getAudioRingBuffer();
+    if (FrameCnt)
+    {
+        // A skipped frame doesn't wait for line buffers, so the audio
+        // ring keeps the emulation at the real speed instead
+        while (ring.getFullWritableSize() < AudioPaceSamples)
+            ;
+    }
+    return ring.getFullWritableSize();
 }
 
-void __not_in_flash_func(InfoNES_SoundOutput)(int samples, BYTE *wave1, BYTE *wave2, BYTE *wave3, BYTE *wave4, BYTE *wave5)
+void __not_in_flash_func(InfoNES_SoundOutput)(int samples, const short *lr)
 {
     while (samples)
     {
@@ -335,26 +408,8 @@ void __not_in_flash_func(InfoNES_SoundOutput)(int samples, BYTE *wave1, BYTE *wa
         int ct = n;
         while (ct--)
         {
-            int w1 = *wave1++;
-            int w2 = *wave2++;
-            int w3 = *wave3++;
-            int w4 = *wave4++;
-            int w5 = *wave5++;
-            //            w3 = w2 = w4 = w5 = 0;
-            int l = w1 * 6 + w2 * 3 + w3 * 5 + w4 * 3 * 17 + w5 * 2 * 32;
-            int r = w1 * 3 + w2 * 6 + w3 * 5 + w4 * 3 * 17 + w5 * 2 * 32;
-            *p++ = {static_cast<short>(l), static_cast<short>(r)};
-
-            // pulse_out = 0.00752 * (pulse1 + pulse2)
-            // tnd_out = 0.00851 * triangle + 0.00494 * noise + 0.00335 * dmc
-
-            // 0.00851/0.00752 = 1.131648936170213
-            // 0.00494/0.00752 = 0.6569148936170213
-            // 0.00335/0.00752 = 0.4454787234042554
-
-            // 0.00752/0.00851 = 0.8836662749706228
-            // 0.00494/0.00851 = 0.5804935370152762
-            // 0.00335/0.00851 = 0.3936545240893067
+            *p++ = {lr[0], lr[1]};
+            lr += 2;
         }
 
         ring.advanceWritePointer(n);
@@ -369,12 +424,22 @@ void InfoNES_LoadFrame()
     gpio_put(LED_PIN, hw_divider_s32_quotient_inlined(dvi_->getFrameCounter(), 60) & 1);
     //    printf("%04x\n", PC);
 
+    governFrameSkip();
+
     tuh_task();
 }
 
 namespace
 {
     dvi::DVI::LineBuffer *currentLineBuffer_{};
+#if INFONES_RENDER_PIPE
+    // パイプライン中は core1 が描いてから渡す
+    dvi::DVI::LineBuffer *lineBuffers_[NES_DISP_HEIGHT];
+#endif
+#if INFONES_RENDER_PIPE || INFONES_APU_PIPE
+    // setLineBuffer() 済みで、まだ変換していないライン数
+    std::atomic<int> validLines_{0};
+#endif
 }
 
 void __not_in_flash_func(drawWorkMeterUnit)(int timing,
@@ -415,16 +480,31 @@ void __not_in_flash_func(drawWorkMeter)(int line)
 void __not_in_flash_func(InfoNES_PreDrawLine)(int line)
 {
     util::WorkMeterMark(0xaaaa);
+    uint32_t t0 = time_us_32();
     auto b = dvi_->getLineBuffer();
+    lineWaitUS_ += time_us_32() - t0;
     util::WorkMeterMark(0x5555);
     InfoNES_SetLineBuffer(b->data() + 32, b->size());
     //    (*b)[319] = line + dvi_->getFrameCounter();
 
+#if INFONES_RENDER_PIPE
+    lineBuffers_[line] = b;
+#endif
     currentLineBuffer_ = b;
 }
 
 void __not_in_flash_func(InfoNES_PostDrawLine)(int line)
 {
+#if INFONES_RENDER_PIPE
+    if (RenderPipe)
+    {
+        // core1 から呼ばれる
+        dvi_->setLineBuffer(line, lineBuffers_[line]);
+        validLines_.fetch_add(1, std::memory_order_release);
+        return;
+    }
+#endif
+
 #if !defined(NDEBUG)
     util::WorkMeterMark(0xffff);
     drawWorkMeter(line);
@@ -433,8 +513,18 @@ void __not_in_flash_func(InfoNES_PostDrawLine)(int line)
     assert(currentLineBuffer_);
     dvi_->setLineBuffer(line, currentLineBuffer_);
     currentLineBuffer_ = nullptr;
+#if INFONES_RENDER_PIPE || INFONES_APU_PIPE
+    validLines_.fetch_add(1, std::memory_order_release);
+#endif
 }
 
+#if INFONES_RENDER_PIPE || INFONES_APU_PIPE
+void __not_in_flash_func(InfoNES_PipeWait)()
+{
+    tight_loop_contents();
+}
+#endif
+
 bool loadAndReset()
 {
     auto rom = romSelector_.getCurrentROM();
@@ -467,16 +557,63 @@ int InfoNES_Menu()
     return 0;
 }
 
+#if INFONES_APU_PIPE
+// 音声リングに空きがあれば 1 バッチ合成する
+bool __not_in_flash_func(renderAudio)()
+{
+    return dvi_->getAudioRingBuffer().getFullWritableSize() >= APU_BATCH_SAMPLES &&
+           InfoNES_pAPURender(1);
+}
+#endif
+
+#if INFONES_RENDER_PIPE || INFONES_APU_PIPE
+// 変換するラインが届くまで待つ
+// パイプライン中はラインを描くのも音声を合成するのも core1 なので、変換で待つ前に進めておく
+// (スキップしたフレームはラインが届かないので、core0 は音声リングの空きでペースが決まる)
+bool __not_in_flash_func(waitForLine)()
+{
+    while (!validLines_.load(std::memory_order_acquire))
+    {
+        if (exclProc_.isExist())
+        {
+            return false;
+        }
+
+        bool busy = false;
+#if INFONES_RENDER_PIPE
+        busy |= InfoNES_PipeRender(1) != 0;
+#endif
+#if INFONES_APU_PIPE
+        busy |= renderAudio();
+#endif
+        if (!busy)
+        {
+            InfoNES_PipeWait();
+        }
+    }
+    return true;
+}
+#endif
+
 void __not_in_flash_func(core1_main)()
 {
     while (true)
     {
         dvi_->registerIRQThisCore();
+#if INFONES_RENDER_PIPE || INFONES_APU_PIPE
+        waitForLine();
+#endif
         dvi_->waitForValidLine();
 
         dvi_->start();
         while (!exclProc_.isExist())
         {
+#if INFONES_RENDER_PIPE || INFONES_APU_PIPE
+            if (!waitForLine())
+            {
+                break;
+            }
+#endif
             if (scaleMode8_7_)
             {
                 dvi_->convertScanBuffer12bppScaled16_7(34, 32, 288 * 2);
@@ -487,6 +624,17 @@ void __not_in_flash_func(core1_main)()
             {
                 dvi_->convertScanBuffer12bpp();
             }
+#if INFONES_RENDER_PIPE || INFONES_APU_PIPE
+            validLines_.fetch_sub(1, std::memory_order_relaxed);
+#endif
+#if INFONES_RENDER_PIPE
+            // 変換の合間に 1 ライン描く
+            InfoNES_PipeRender(1);
+#endif
+#if INFONES_APU_PIPE
+            // core0 はバッチのリングが詰まると待つので、これが実速度のペースになる
+            renderAudio();
+#endif
         }
 
         dvi_->unregisterIRQThisCore();
@@ -556,7 +704,7 @@ int main()
                                       dvi::getTiming640x480p60Hz());
     //    dvi_->setAudioFreq(48000, 25200, 6144);
     dvi_->setAudioFreq(44100, 28000, 6272);
-    dvi_->allocateAudioBuffer(256);
+    dvi_->allocateAudioBuffer(AudioBufferSize);
     //    dvi_->setExclusiveProc(&exclProc_);
 
     dvi_->getBlankSettings().top = 4 * 2;
@@ -568,6 +716,12 @@ int main()
     // 空サンプル詰めとく
     dvi_->getAudioRingBuffer().advanceWritePointer(255);
 
+#if INFONES_RENDER_PIPE
+    InfoNES_PipeEnable(1);
+#endif
+#if INFONES_APU_PIPE
+    InfoNES_pAPUPipeEnable(1);
+#endif
     multicore_launch_core1(core1_main);
 
     InfoNES_Main();